@@ -20,6 +20,7 @@
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "esp_heap_caps.h"
+#include "esp_timer.h"
 #include "esp_spiffs.h"
 #include "driver/i2s.h"
 #include "audio.h"
@@ -35,6 +36,7 @@
 #include "freertos/queue.h"
 #include "freertos/semphr.h"
 #include "logger.h"
+#include "player_state.h"
 
 static const char *TAG = "AUDIO";
 
@@ -47,7 +49,26 @@ static const char *TAG = "AUDIO";
 
 #define AUDIO_MAX_PLAY_LIST 3
 
+#define I2S_DMA_BUF_COUNT 6
+#define I2S_DMA_BUF_LEN 256
+
+/*!< Volume-only messages arriving within this window are applied as one */
+#define VOLUME_COALESCE_MS 80
+#define VOLUME_STEP 5
+
+#define COMMAND_QUEUE_LEN 20
+#define LOCAL_QUEUE_LEN 8
+
+/*
+ * Local (touch) commands have their own queue, served before the remote one
+ * and in arrival order. command_pending counts the messages in both, so the
+ * handler can block on either; a message is always queued before its count
+ * is given and the count taken before it is received.
+ */
 static QueueHandle_t command_queue;
+static QueueHandle_t local_queue;
+static SemaphoreHandle_t command_pending;
+static TaskHandle_t audio_task_handle = NULL;
 
 /*!< aduio music list from spiffs*/
 const char audio_list[AUDIO_MAX_PLAY_LIST][64] = {
@@ -61,77 +82,404 @@ enum
     AUDIO_PLAY,
     AUDIO_NEXT,
     AUDIO_LAST,
-    AUDIO_STOPT
+    AUDIO_STOPT,
+    AUDIO_SELECT
 };
 
+typedef struct
+{
+    uint8_t count;
+    audio_action_t actions[AUDIO_BATCH_MAX];
+} audio_message_t;
+
 int play_flag = AUDIO_STOP;
 int audio_play_index = 0;
 
+/*!< Track to jump to on AUDIO_SELECT, and whether it should start paused */
+static volatile int requested_index = 0;
+static volatile bool start_paused = false;
+/*!< Position to seek to once the decoder knows the bitrate, -1 if none */
+static volatile int32_t requested_seek_ms = -1;
+
+static volatile uint32_t underrun_count = 0;
+
+uint32_t audio_get_underrun_count(void)
+{
+    return underrun_count;
+}
+
+static BaseType_t queue_commands(const audio_action_t *actions, size_t count, QueueHandle_t queue)
+{
+    if (queue == NULL || count == 0 || count > AUDIO_BATCH_MAX)
+    {
+        return pdFAIL;
+    }
+
+    audio_message_t message = {.count = count};
+    memcpy(message.actions, actions, count * sizeof(audio_action_t));
+    if (xQueueSend(queue, &message, portMAX_DELAY) != pdPASS)
+    {
+        return pdFAIL;
+    }
+    xSemaphoreGive(command_pending);
+    return pdPASS;
+}
+
+BaseType_t send_commands(const audio_action_t *actions, size_t count)
+{
+    return queue_commands(actions, count, command_queue);
+}
+
+BaseType_t send_commands_local(const audio_action_t *actions, size_t count)
+{
+    return queue_commands(actions, count, local_queue);
+}
+
 BaseType_t send_command(audio_command_t command)
 {
-    ESP_LOGI(TAG, "Player command received => %d", command);
-    if (command_queue != NULL)
+    return send_command_value(command, 0);
+}
+
+BaseType_t send_command_value(audio_command_t command, int32_t value)
+{
+    ESP_LOGI(TAG, "Player command received => %d (%d)", command, value);
+    audio_action_t action = {.command = command, .value = value};
+    return send_commands(&action, 1);
+}
+
+/*!< Wake the playback task in case it is parked in audio_idle_wait() */
+static void audio_wake(void)
+{
+    if (audio_task_handle != NULL)
+    {
+        xTaskNotifyGive(audio_task_handle);
+    }
+}
+
+static bool is_volume_action(const audio_action_t *action)
+{
+    return action->command == VOL_UP_AUDIO || action->command == VOL_DOWN_AUDIO ||
+           action->command == SET_VOLUME_AUDIO;
+}
+
+static bool is_volume_message(const audio_message_t *message)
+{
+    for (int i = 0; i < message->count; i++)
+    {
+        if (!is_volume_action(&message->actions[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Next message, local ones first. With `volume_only`, a message that isn't
+ * volume only is left queued and false returned, like a failed peek.
+ */
+static bool command_receive(audio_message_t *message, TickType_t wait, bool volume_only)
+{
+    if (xSemaphoreTake(command_pending, wait) != pdTRUE)
+    {
+        return false;
+    }
+
+    QueueHandle_t queue = uxQueueMessagesWaiting(local_queue) > 0 ? local_queue : command_queue;
+    if (volume_only && (xQueuePeek(queue, message, 0) != pdTRUE || !is_volume_message(message)))
+    {
+        xSemaphoreGive(command_pending);
+        return false;
+    }
+
+    return xQueueReceive(queue, message, 0) == pdTRUE;
+}
+
+/*
+ * Apply one volume action to a running target, clamped to 0 ~ 100.
+ * `absolute` is set once any action in the run was an absolute set.
+ */
+static int volume_step(const audio_action_t *action, int target, bool *absolute)
+{
+    switch (action->command)
+    {
+    case VOL_UP_AUDIO:
+        target += VOLUME_STEP;
+        break;
+    case VOL_DOWN_AUDIO:
+        target -= VOLUME_STEP;
+        break;
+    case SET_VOLUME_AUDIO:
+        target = action->value;
+        *absolute = true;
+        break;
+    default:
+        break;
+    }
+
+    if (target < 0)
+    {
+        return 0;
+    }
+    return target > 100 ? 100 : target;
+}
+
+/*
+ * Write the folded volume to the codec and log a single event for the
+ * whole run of volume actions, whatever its length.
+ */
+static void volume_commit(int target, int *volume, bool absolute, uint8_t song_id)
+{
+    /*!< a volume command counts as activity for the idle standby timer too */
+    audio_wake();
+
+    if (target == *volume)
+    {
+        return;
+    }
+
+    ESP_LOGI(TAG, "VOLUME %d -> %d", *volume, target);
+    buffer_write(absolute ? VOLUME_SET : target > *volume ? VOLUME_UP : VOLUME_DOWN, song_id);
+    *volume = target;
+    if (es8311_set_voice_volume_async(target) != ESP_OK)
+    {
+        es8311_set_voice_volume(target);
+    }
+    player_state_set_volume(target);
+}
+
+/*
+ * Fold every action of the message into a target volume / track / play
+ * state, then touch the codec and the playback task once.
+ */
+static void command_apply(const audio_message_t *message, int *volume)
+{
+    int target_volume = *volume;
+    bool volume_absolute = false;
+    int target_index = audio_play_index;
+    int target_play = play_flag == AUDIO_STOP ? AUDIO_STOP : AUDIO_PLAY;
+    bool play_changed = false;
+    bool track_changed = false;
+    bool stop = false;
+    int32_t seek_ms = -1;
+
+    for (int i = 0; i < message->count; i++)
+    {
+        const audio_action_t *action = &message->actions[i];
+
+        switch (action->command)
+        {
+        case PLAY_PAUSE_AUDIO:
+            ESP_LOGI(TAG, "PLAY / STOP");
+            target_play = target_play ? AUDIO_STOP : AUDIO_PLAY;
+            play_changed = true;
+            buffer_write(PLAY_PAUSE, target_index);
+            break;
+        case PLAY_AUDIO:
+        case PAUSE_AUDIO:
+            ESP_LOGI(TAG, action->command == PLAY_AUDIO ? "PLAY" : "PAUSE");
+            target_play = action->command == PLAY_AUDIO ? AUDIO_PLAY : AUDIO_STOP;
+            play_changed = true;
+            buffer_write(PLAY_PAUSE, target_index);
+            break;
+        case NEXT_AUDIO:
+            ESP_LOGI(TAG, "AUDIO_NEXT");
+            buffer_write(NEXT, target_index);
+            target_index = (target_index + 1) % AUDIO_MAX_PLAY_LIST;
+            track_changed = true;
+            stop = false;
+            seek_ms = -1;
+            break;
+        case PREVIOUS_AUDIO:
+            ESP_LOGI(TAG, "AUDIO_LAST");
+            buffer_write(PREVIOUS, target_index);
+            target_index = (target_index + AUDIO_MAX_PLAY_LIST - 1) % AUDIO_MAX_PLAY_LIST;
+            track_changed = true;
+            stop = false;
+            seek_ms = -1;
+            break;
+        case SELECT_TRACK_AUDIO:
+            if (action->value < 0 || action->value >= AUDIO_MAX_PLAY_LIST)
+            {
+                ESP_LOGW(TAG, "Track %d out of range", action->value);
+                break;
+            }
+            ESP_LOGI(TAG, "SELECT_TRACK %d", action->value);
+            target_index = action->value;
+            track_changed = true;
+            stop = false;
+            seek_ms = -1;
+            buffer_write(TRACK_SELECT, target_index);
+            break;
+        case SEEK_AUDIO:
+            if (action->value < 0)
+            {
+                ESP_LOGW(TAG, "Seek position %d out of range", action->value);
+                break;
+            }
+            ESP_LOGI(TAG, "SEEK %d ms", action->value);
+            seek_ms = action->value;
+            buffer_write(SEEK, target_index);
+            break;
+        case STOP_AUDIO:
+            ESP_LOGI(TAG, "STOP");
+            buffer_write(STOP, target_index);
+            target_index = 0;
+            stop = true;
+            track_changed = false;
+            seek_ms = -1;
+            break;
+        case VOL_UP_AUDIO:
+        case VOL_DOWN_AUDIO:
+        case SET_VOLUME_AUDIO:
+            target_volume = volume_step(action, target_volume, &volume_absolute);
+            break;
+        default:
+            break;
+        }
+    }
+
+    volume_commit(target_volume, volume, volume_absolute, audio_play_index);
+
+    if (seek_ms >= 0 && !stop)
+    {
+        /*!< picked up by the playback task, after the track switch if any */
+        requested_seek_ms = seek_ms;
+    }
+
+    if (stop)
+    {
+        play_flag = AUDIO_STOPT;
+    }
+    else if (track_changed)
+    {
+        /*!< publish the target before the flag the playback task polls */
+        start_paused = play_changed && target_play == AUDIO_STOP;
+        requested_index = target_index;
+        play_flag = AUDIO_SELECT;
+    }
+    else if (play_changed)
     {
-        return xQueueSend(command_queue, &command, portMAX_DELAY);
+        play_flag = target_play;
+        player_state_set_play_state(play_flag ? PLAYER_STATE_PLAYING : PLAYER_STATE_PAUSED);
+    }
+
+    if (stop || track_changed || play_changed)
+    {
+        audio_wake();
     }
-    return pdFAIL;
 }
 
 static void command_handler(void *arg)
 {
 
-    uint32_t volume = 50;
+    int volume = 50;
     es8311_set_voice_volume(volume);
+    player_state_set_volume(volume);
 
     while (1)
     {
-        audio_command_t command;
-        if (xQueueReceive(command_queue, &command, portMAX_DELAY) == pdTRUE)
+        audio_message_t message;
+        if (!command_receive(&message, portMAX_DELAY, false))
+        {
+            continue;
+        }
+
+        if (!is_volume_message(&message))
         {
+            command_apply(&message, &volume);
+            continue;
+        }
 
-            switch (command)
+        /*!< Absorb the rest of a tap / hold burst into one codec write */
+        int target = volume;
+        bool absolute = false;
+        TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(VOLUME_COALESCE_MS);
+
+        while (1)
+        {
+            for (int i = 0; i < message.count; i++)
+            {
+                target = volume_step(&message.actions[i], target, &absolute);
+            }
+
+            TickType_t now = xTaskGetTickCount();
+            TickType_t wait = (int32_t)(deadline - now) > 0 ? deadline - now : 0;
+            if (!command_receive(&message, wait, true))
             {
-            case PLAY_PAUSE_AUDIO:
-                ESP_LOGI(TAG, "PLAY / STOP");
-                play_flag = play_flag ? AUDIO_STOP : AUDIO_PLAY;
-                buffer_write(0, audio_play_index);
-                break;
-            case NEXT_AUDIO:
-                ESP_LOGI(TAG, "AUDIO_NEXT");
-                play_flag = AUDIO_NEXT;
-                buffer_write(1, audio_play_index);
-                break;
-            case PREVIOUS_AUDIO:
-                ESP_LOGI(TAG, "AUDIO_LAST");
-                play_flag = AUDIO_LAST;
-                buffer_write(2, audio_play_index);
-                break;
-            case STOP_AUDIO:
-                ESP_LOGI(TAG, "STOP");
-                play_flag = AUDIO_STOPT;
-                buffer_write(3, audio_play_index);
-                break;
-            case VOL_UP_AUDIO:
-                ESP_LOGI(TAG, "VOLUME_UP");
-                volume += 5;
-                es8311_set_voice_volume(volume);
-                buffer_write(4, audio_play_index);
-                break;
-            case VOL_DOWN_AUDIO:
-                ESP_LOGI(TAG, "VOLUME_DOWN");
-                volume -= 5;
-                es8311_set_voice_volume(volume);
-                buffer_write(5, audio_play_index);
-                break;
-            default:
                 break;
             }
         }
+
+        volume_commit(target, &volume, absolute, audio_play_index);
     }
 }
 
 /////
 
+static void audio_standby_exit(void)
+{
+    int64_t start = esp_timer_get_time();
+    es8311_standby(false);
+    i2s_zero_dma_buffer(I2S_NUM);
+    i2s_start(I2S_NUM);
+    int wake_ms = (esp_timer_get_time() - start) / 1000;
+
+    if (wake_ms > CONFIG_AUDIO_WAKE_TARGET_MS)
+    {
+        ESP_LOGW(TAG, "standby wake took %d ms (target %d ms)", wake_ms, CONFIG_AUDIO_WAKE_TARGET_MS);
+    }
+    else
+    {
+        ESP_LOGI(TAG, "standby wake took %d ms", wake_ms);
+    }
+}
+
+/*
+ * Park the playback task while paused. After CONFIG_AUDIO_IDLE_STANDBY_MS
+ * without a command, I2S DMA is stopped and the codec and PA go into
+ * standby. Every command, volume included, notifies the task: it powers
+ * everything back up and restarts the idle period, and the one that moves
+ * play_flag off AUDIO_STOP also resumes decoding.
+ */
+static void audio_idle_wait(void)
+{
+    TickType_t idle_ticks = CONFIG_AUDIO_IDLE_STANDBY_MS > 0 ? pdMS_TO_TICKS(CONFIG_AUDIO_IDLE_STANDBY_MS) : portMAX_DELAY;
+    bool standby = false;
+
+    i2s_zero_dma_buffer(I2S_NUM);
+
+    while (play_flag == AUDIO_STOP)
+    {
+        if (ulTaskNotifyTake(pdTRUE, standby ? portMAX_DELAY : idle_ticks) != 0)
+        {
+            if (standby)
+            {
+                audio_standby_exit();
+                standby = false;
+            }
+        }
+        else if (!standby && play_flag == AUDIO_STOP)
+        {
+            ESP_LOGI(TAG, "idle, entering standby");
+            i2s_stop(I2S_NUM);
+            es8311_standby(true);
+            standby = true;
+        }
+    }
+
+    if (standby)
+    {
+        audio_standby_exit();
+    }
+}
+
+/*!< es8311_set_sample_rate() calls this while the DAC is muted, arg is the channel count */
+static esp_err_t audio_reclock(int sample_rate, void *arg)
+{
+    return i2s_set_clk(I2S_NUM, sample_rate, 16, *(int *)arg);
+}
+
 void aplay_mp3(const char *path)
 {
     ESP_LOGI(TAG, "start to decode %s", path);
@@ -192,9 +540,17 @@ void aplay_mp3(const char *path)
         }
     }
 
+    long data_start = ftell(mp3File);
+    int bitrate = 0;
     int bytesLeft = 0;
     unsigned char *readPtr = readBuf;
-    play_flag = AUDIO_PLAY;
+    uint64_t samples_played = 0;
+    int64_t last_write_us = 0;
+    play_flag = start_paused ? AUDIO_STOP : AUDIO_PLAY;
+    start_paused = false;
+    player_state_set_position(0);
+    player_state_set_song(audio_play_index);
+    player_state_set_play_state(play_flag ? PLAYER_STATE_PLAYING : PLAYER_STATE_PAUSED);
 
     while (1)
     {
@@ -202,17 +558,15 @@ void aplay_mp3(const char *path)
         {
         case AUDIO_STOP:
         {
-            while (!play_flag)
-            {
-                i2s_zero_dma_buffer(0);
-                vTaskDelay(100 / portTICK_RATE_MS);
-            }
+            audio_idle_wait();
+            last_write_us = 0;
         }
         break;
         case AUDIO_STOPT:
         {
             audio_play_index = 0;
             play_flag = AUDIO_STOP;
+            player_state_set_play_state(PLAYER_STATE_STOPPED);
             goto stop;
         }
         break;
@@ -251,6 +605,26 @@ void aplay_mp3(const char *path)
             goto stop;
         }
         break;
+
+        case AUDIO_SELECT:
+        {
+            audio_play_index = requested_index;
+            goto stop;
+        }
+        break;
+        }
+
+        /*!< Seek by byte offset at the current bitrate, exact for CBR files */
+        int32_t seek_ms = requested_seek_ms;
+        if (seek_ms >= 0 && bitrate != 0)
+        {
+            requested_seek_ms = -1;
+            fseek(mp3File, data_start + (int64_t)seek_ms * bitrate / 8000, SEEK_SET);
+            bytesLeft = 0;
+            readPtr = readBuf;
+            samples_played = (uint64_t)seek_ms * samplerate / 1000;
+            last_write_us = 0;
+            player_state_set_position(seek_ms);
         }
 
         if (bytesLeft < MAINBUF_SIZE)
@@ -288,15 +662,28 @@ void aplay_mp3(const char *path)
             }
 
             MP3GetLastFrameInfo(hMP3Decoder, &mp3FrameInfo);
+            bitrate = mp3FrameInfo.bitrate;
 
             if (samplerate != mp3FrameInfo.samprate)
             {
                 samplerate = mp3FrameInfo.samprate;
-                i2s_set_clk(0, samplerate, 16, mp3FrameInfo.nChans);
+                es8311_set_sample_rate(samplerate, audio_reclock, &mp3FrameInfo.nChans);
+            }
+
+            /*!< DMA holds I2S_DMA_BUF_COUNT * I2S_DMA_BUF_LEN frames, a longer gap means it ran dry */
+            int64_t now_us = esp_timer_get_time();
+            if (last_write_us != 0 &&
+                now_us - last_write_us > (int64_t)I2S_DMA_BUF_COUNT * I2S_DMA_BUF_LEN * 1000000 / samplerate)
+            {
+                underrun_count++;
             }
 
             size_t bytes_write = 0;
             i2s_write(0, (const char *)output, mp3FrameInfo.outputSamps * 2, &bytes_write, 100 / portTICK_RATE_MS);
+            last_write_us = esp_timer_get_time();
+
+            samples_played += mp3FrameInfo.outputSamps / mp3FrameInfo.nChans;
+            player_state_set_position(samples_played * 1000 / samplerate);
         }
     }
 
@@ -323,8 +710,8 @@ static void audio_task(void *arg)
         .bits_per_sample = 16,
         .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT, /*!< 1-channels */
         .communication_format = I2S_COMM_FORMAT_I2S,
-        .dma_buf_count = 6,
-        .dma_buf_len = 256,
+        .dma_buf_count = I2S_DMA_BUF_COUNT,
+        .dma_buf_len = I2S_DMA_BUF_LEN,
         .use_apll = true,
         .tx_desc_auto_clear = true, /*!< I2S auto clear tx descriptor if there is underflow condition (helps in avoiding noise in case of data unavailability) */
         .intr_alloc_flags = ESP_INTR_FLAG_LEVEL2 | ESP_INTR_FLAG_IRAM,
@@ -349,8 +736,10 @@ static void audio_task(void *arg)
 int audio_init()
 {
 
-    command_queue = xQueueCreate(20, sizeof(audio_command_t));
-    if (command_queue == NULL)
+    command_queue = xQueueCreate(COMMAND_QUEUE_LEN, sizeof(audio_message_t));
+    local_queue = xQueueCreate(LOCAL_QUEUE_LEN, sizeof(audio_message_t));
+    command_pending = xSemaphoreCreateCounting(COMMAND_QUEUE_LEN + LOCAL_QUEUE_LEN, 0);
+    if (command_queue == NULL || local_queue == NULL || command_pending == NULL)
     {
         ESP_LOGE(TAG, "Failed to create command queue");
         return -1;
@@ -359,7 +748,7 @@ int audio_init()
     es8311_init(SAMPLE_RATE);
     es8311_set_voice_volume(50);
 
-    xTaskCreate(audio_task, "audio_task", 4096, NULL, 5, NULL);
+    xTaskCreate(audio_task, "audio_task", 4096, NULL, 5, &audio_task_handle);
     xTaskCreate(command_handler, "command_handler_task", 2048, NULL, 5, NULL);
 
     return 0;
@@ -0,0 +1,226 @@
+#include <string.h>
+#include "command_router.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "logger.h"
+
+static const char *TAG = "command_router";
+
+/*!< Remote commands are refused for this long after a touch command */
+#define LOCAL_HOLDOFF_US (500 * 1000)
+
+/*!< No event number, only reachable by name */
+#define EVENT_NONE -1
+
+typedef struct
+{
+    int event;
+    const char *name;
+    audio_command_t command;
+    bool needs_value;
+} command_def_t;
+
+static const command_def_t command_table[] = {
+    {PLAY_PAUSE, "toggle", PLAY_PAUSE_AUDIO, false},
+    {NEXT, "next", NEXT_AUDIO, false},
+    {PREVIOUS, "previous", PREVIOUS_AUDIO, false},
+    {STOP, "stop", STOP_AUDIO, false},
+    {VOLUME_UP, "volume_up", VOL_UP_AUDIO, false},
+    {VOLUME_DOWN, "volume_down", VOL_DOWN_AUDIO, false},
+    {VOLUME_SET, "volume", SET_VOLUME_AUDIO, true},
+    {TRACK_SELECT, "track", SELECT_TRACK_AUDIO, true},
+    {SEEK, "seek", SEEK_AUDIO, true},
+    {EVENT_NONE, "play", PLAY_AUDIO, false},
+    {EVENT_NONE, "pause", PAUSE_AUDIO, false},
+};
+
+#define COMMAND_TABLE_SIZE (sizeof(command_table) / sizeof(command_table[0]))
+
+typedef struct
+{
+    const char *name;
+    uint32_t burst;      /*!< bucket size, 0 for unlimited */
+    uint32_t per_second; /*!< refill rate */
+    bool local;
+} source_def_t;
+
+static const source_def_t source_table[COMMAND_SOURCE_MAX] = {
+    [COMMAND_SOURCE_TOUCH] = {"touch", 0, 0, true},
+    [COMMAND_SOURCE_HTTP] = {"http", 20, 10, false},
+    [COMMAND_SOURCE_MQTT] = {"mqtt", 20, 10, false},
+};
+
+typedef struct
+{
+    uint32_t tokens_milli; /*!< tokens x 1000, so slow refill rates don't round away */
+    int64_t refill_us;
+    command_source_stats_t stats;
+} source_state_t;
+
+static source_state_t sources[COMMAND_SOURCE_MAX];
+static int64_t last_local_us = 0;
+static portMUX_TYPE router_lock = portMUX_INITIALIZER_UNLOCKED;
+
+const char *command_source_name(command_source_t source)
+{
+    return source < COMMAND_SOURCE_MAX ? source_table[source].name : "unknown";
+}
+
+static const command_def_t *find_event(int event)
+{
+    for (int i = 0; i < COMMAND_TABLE_SIZE; i++)
+    {
+        if (command_table[i].event != EVENT_NONE && command_table[i].event == event)
+        {
+            return &command_table[i];
+        }
+    }
+    return NULL;
+}
+
+bool command_lookup_name(const char *name, size_t len, audio_action_t *action, bool *needs_value)
+{
+    for (int i = 0; i < COMMAND_TABLE_SIZE; i++)
+    {
+        if (strlen(command_table[i].name) == len && memcmp(command_table[i].name, name, len) == 0)
+        {
+            action->command = command_table[i].command;
+            action->value = 0;
+            *needs_value = command_table[i].needs_value;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!< Token bucket and hold-off check, caller holds router_lock */
+static esp_err_t admit(command_source_t source, int64_t now)
+{
+    const source_def_t *def = &source_table[source];
+    source_state_t *state = &sources[source];
+
+    if (def->local)
+    {
+        last_local_us = now;
+        return ESP_OK;
+    }
+
+    if (last_local_us != 0 && now - last_local_us < LOCAL_HOLDOFF_US)
+    {
+        state->stats.held_off++;
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (def->burst == 0)
+    {
+        return ESP_OK;
+    }
+
+    uint32_t full = def->burst * 1000;
+    if (state->refill_us == 0)
+    {
+        state->tokens_milli = full;
+    }
+    else
+    {
+        uint64_t refill = (uint64_t)(now - state->refill_us) * def->per_second / 1000;
+        state->tokens_milli = refill >= full - state->tokens_milli ? full : state->tokens_milli + refill;
+    }
+    state->refill_us = now;
+
+    if (state->tokens_milli < 1000)
+    {
+        state->stats.rate_limited++;
+        return ESP_ERR_INVALID_STATE;
+    }
+    state->tokens_milli -= 1000;
+
+    return ESP_OK;
+}
+
+esp_err_t command_route(command_source_t source, const audio_action_t *actions, size_t count)
+{
+    if (source >= COMMAND_SOURCE_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int64_t start = esp_timer_get_time();
+
+    portENTER_CRITICAL(&router_lock);
+    esp_err_t err = admit(source, start);
+    portEXIT_CRITICAL(&router_lock);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "%s command refused (%s)", source_table[source].name, esp_err_to_name(err));
+        return err;
+    }
+
+    BaseType_t sent = source_table[source].local ? send_commands_local(actions, count)
+                                                 : send_commands(actions, count);
+    uint32_t latency_us = esp_timer_get_time() - start;
+
+    portENTER_CRITICAL(&router_lock);
+    command_source_stats_t *stats = &sources[source].stats;
+    if (sent == pdPASS)
+    {
+        stats->accepted++;
+        stats->latency_total_us += latency_us;
+        if (latency_us > stats->latency_max_us)
+        {
+            stats->latency_max_us = latency_us;
+        }
+    }
+    else
+    {
+        stats->failed++;
+    }
+    portEXIT_CRITICAL(&router_lock);
+
+    return sent == pdPASS ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t command_route_event(command_source_t source, int event, bool has_value, int32_t value)
+{
+    const command_def_t *def = find_event(event);
+    esp_err_t err = ESP_OK;
+
+    if (def == NULL)
+    {
+        err = ESP_ERR_NOT_SUPPORTED;
+    }
+    else if (def->needs_value && !has_value)
+    {
+        err = ESP_ERR_INVALID_ARG;
+    }
+
+    if (err != ESP_OK)
+    {
+        if (source < COMMAND_SOURCE_MAX)
+        {
+            portENTER_CRITICAL(&router_lock);
+            sources[source].stats.invalid++;
+            portEXIT_CRITICAL(&router_lock);
+        }
+        ESP_LOGW(TAG, "Invalid event %d from %s", event, command_source_name(source));
+        return err;
+    }
+
+    audio_action_t action = {.command = def->command, .value = has_value ? value : 0};
+    return command_route(source, &action, 1);
+}
+
+void command_router_get_stats(command_source_t source, command_source_stats_t *stats)
+{
+    if (source >= COMMAND_SOURCE_MAX)
+    {
+        memset(stats, 0, sizeof(command_source_stats_t));
+        return;
+    }
+
+    portENTER_CRITICAL(&router_lock);
+    *stats = sources[source].stats;
+    portEXIT_CRITICAL(&router_lock);
+}
@@ -18,6 +18,8 @@ extern "C"
 {
 #endif
 
+#include <stdint.h>
+#include <stddef.h>
 #include "driver/rmt.h"
 
     typedef enum
@@ -28,9 +30,22 @@ extern "C"
         NEXT_AUDIO,
         STOP_AUDIO,
         VOL_UP_AUDIO,
-        VOL_DOWN_AUDIO
+        VOL_DOWN_AUDIO,
+        SET_VOLUME_AUDIO,   /*!< value: absolute volume (0 ~ 100) */
+        SELECT_TRACK_AUDIO, /*!< value: play list index */
+        PLAY_AUDIO,
+        PAUSE_AUDIO,
+        SEEK_AUDIO /*!< value: position in the current track, in milliseconds */
     } audio_command_t;
 
+#define AUDIO_BATCH_MAX 8
+
+    typedef struct
+    {
+        audio_command_t command;
+        int32_t value; /*!< argument for the commands that take one */
+    } audio_action_t;
+
     /**
      * @brief Initialize the audio and create task to play and control music.
      *        Note: You need to initialize touch before you can initialize audio
@@ -44,6 +59,34 @@ extern "C"
      */
     BaseType_t send_command(audio_command_t command);
 
+    /**
+     * @brief Queue a command that carries a target value (absolute volume,
+     *        track index or seek position), see audio_command_t.
+     */
+    BaseType_t send_command_value(audio_command_t command, int32_t value);
+
+    /**
+     * @brief Queue up to AUDIO_BATCH_MAX actions as a single message. The audio
+     *        engine applies them in order and commits the resulting volume,
+     *        track and play state once, so no other command can interleave.
+     *
+     * @return - pdPASS on success
+     *         - pdFAIL if the batch is empty, too long or the queue isn't ready
+     */
+    BaseType_t send_commands(const audio_action_t *actions, size_t count);
+
+    /**
+     * @brief Same as send_commands() but on the local queue, which is served
+     *        before remote commands, in arrival order. For local input.
+     */
+    BaseType_t send_commands_local(const audio_action_t *actions, size_t count);
+
+    /**
+     * @brief Number of times playback ran dry since boot, i.e. the decoder
+     *        took longer between two I2S writes than the DMA buffers can hold.
+     */
+    uint32_t audio_get_underrun_count(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "audio.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /*
+     * Single entry point for player commands from every input. Each source
+     * has its own token bucket; touch commands jump the audio queue and hold
+     * remote sources off for a moment so a remote can't fight the user.
+     */
+    typedef enum
+    {
+        COMMAND_SOURCE_TOUCH = 0,
+        COMMAND_SOURCE_HTTP,
+        COMMAND_SOURCE_MQTT,
+        COMMAND_SOURCE_MAX
+    } command_source_t;
+
+    typedef struct
+    {
+        uint32_t accepted;
+        uint32_t invalid;      /*!< unknown command or missing value */
+        uint32_t rate_limited; /*!< over the source's token bucket */
+        uint32_t held_off;     /*!< remote command during the local hold-off */
+        uint32_t failed;       /*!< audio queue not ready */
+        uint32_t latency_max_us;
+        uint64_t latency_total_us; /*!< over `accepted`, for the average */
+    } command_source_stats_t;
+
+    /**
+     * @brief Route a command given by its event number (see EventType), as
+     *        HTTP and MQTT clients send them.
+     *
+     * @return - ESP_OK on success
+     *         - ESP_ERR_NOT_SUPPORTED for an unknown event number
+     *         - ESP_ERR_INVALID_ARG if the command needs a value and has none
+     *         - ESP_ERR_INVALID_STATE if rate limited or held off by local input
+     *         - ESP_FAIL if the audio engine isn't ready
+     */
+    esp_err_t command_route_event(command_source_t source, int event, bool has_value, int32_t value);
+
+    /**
+     * @brief Route one or more already decoded actions (up to AUDIO_BATCH_MAX),
+     *        applied atomically like send_commands(). Same return values.
+     */
+    esp_err_t command_route(command_source_t source, const audio_action_t *actions, size_t count);
+
+    /**
+     * @brief Decode a command by name ("play", "volume", ...) into an action
+     *
+     * @return true if the name is known, `needs_value` tells whether the
+     *         caller must fill in action->value
+     */
+    bool command_lookup_name(const char *name, size_t len, audio_action_t *action, bool *needs_value);
+
+    const char *command_source_name(command_source_t source);
+
+    void command_router_get_stats(command_source_t source, command_source_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
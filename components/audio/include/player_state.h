@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef enum
+    {
+        PLAYER_STATE_STOPPED = 0,
+        PLAYER_STATE_PLAYING,
+        PLAYER_STATE_PAUSED
+    } player_play_state_t;
+
+    typedef struct
+    {
+        uint32_t version;       /*!< bumped on every track, play state or volume change */
+        uint8_t song_id;        /*!< index in the play list */
+        uint8_t volume;         /*!< 0 ~ 100 */
+        player_play_state_t play_state;
+        uint32_t position_ms;   /*!< playback position in the current track, not versioned */
+    } player_state_t;
+
+    /**
+     * @brief Take a consistent copy of the player state. Never blocks, it only
+     *        retries if a setter is mid-update. Safe to call from any task.
+     */
+    void player_state_get(player_state_t *state);
+
+    /**
+     * @brief Current state version, cheaper than a full player_state_get()
+     */
+    uint32_t player_state_version(void);
+
+    const char *player_state_name(player_play_state_t play_state);
+
+    /**
+     * @brief Register a task to get a task notification (xTaskNotifyGive) every
+     *        time the state version changes. Meant to be called once at init.
+     *
+     * @return - ESP_OK on success
+     *         - ESP_ERR_NO_MEM if all subscriber slots are taken
+     */
+    esp_err_t player_state_subscribe(TaskHandle_t task);
+
+    /*!< Updaters, only meant to be called by the audio engine */
+    void player_state_set_song(uint8_t song_id);
+    void player_state_set_play_state(player_play_state_t play_state);
+    void player_state_set_volume(int volume);
+    void player_state_set_position(uint32_t position_ms);
+
+#ifdef __cplusplus
+}
+#endif
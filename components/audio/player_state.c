@@ -0,0 +1,136 @@
+#include <stdatomic.h>
+#include "player_state.h"
+
+/*
+ * Track, play state and volume share one 32-bit word guarded by a sequence
+ * counter, odd while a setter is writing:
+ *   fields: [31:24] song_id  [23:16] volume  [15:8] play_state
+ * A 64-bit atomic would not do here, it is not lock-free on Xtensa and
+ * falls back to libatomic's locks. Readers retry instead of blocking, the
+ * version handed out is the sequence halved. Position changes on every
+ * decoded frame, so it lives in its own word and does not bump the version.
+ */
+static atomic_uint state_seq;
+static atomic_uint state_fields = (50u << 16) | ((unsigned int)PLAYER_STATE_STOPPED << 8);
+static portMUX_TYPE state_lock = portMUX_INITIALIZER_UNLOCKED;
+static _Atomic uint32_t position_ms;
+
+#define PLAYER_STATE_MAX_SUBSCRIBERS 4
+
+static TaskHandle_t subscribers[PLAYER_STATE_MAX_SUBSCRIBERS];
+static atomic_int subscriber_count;
+static portMUX_TYPE subscribers_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#define FIELD_SONG 24
+#define FIELD_VOLUME 16
+#define FIELD_PLAY_STATE 8
+
+static const char *play_state_names[] = {
+    "STOPPED",
+    "PLAYING",
+    "PAUSED"};
+
+static void player_state_set_field(int shift, uint8_t value)
+{
+    // Setters are serialised so the sequence only ever has one writer
+    portENTER_CRITICAL(&state_lock);
+    unsigned int fields = atomic_load_explicit(&state_fields, memory_order_relaxed);
+    if (((fields >> shift) & 0xFF) == value)
+    {
+        portEXIT_CRITICAL(&state_lock);
+        return;
+    }
+
+    unsigned int seq = atomic_load_explicit(&state_seq, memory_order_relaxed);
+    atomic_store_explicit(&state_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&state_fields, (fields & ~(0xFFu << shift)) | ((unsigned int)value << shift), memory_order_relaxed);
+    atomic_store_explicit(&state_seq, seq + 2, memory_order_release);
+    portEXIT_CRITICAL(&state_lock);
+
+    int count = atomic_load_explicit(&subscriber_count, memory_order_acquire);
+    for (int i = 0; i < count; i++)
+    {
+        xTaskNotifyGive(subscribers[i]);
+    }
+}
+
+void player_state_get(player_state_t *state)
+{
+    unsigned int seq, fields;
+
+    do
+    {
+        seq = atomic_load_explicit(&state_seq, memory_order_acquire);
+        fields = atomic_load_explicit(&state_fields, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || atomic_load_explicit(&state_seq, memory_order_relaxed) != seq);
+
+    state->version = seq >> 1;
+    state->song_id = (fields >> FIELD_SONG) & 0xFF;
+    state->volume = (fields >> FIELD_VOLUME) & 0xFF;
+    state->play_state = (player_play_state_t)((fields >> FIELD_PLAY_STATE) & 0xFF);
+    state->position_ms = atomic_load_explicit(&position_ms, memory_order_relaxed);
+}
+
+uint32_t player_state_version(void)
+{
+    // Mid-update this is still the previous version, which is what it was
+    return atomic_load_explicit(&state_seq, memory_order_acquire) >> 1;
+}
+
+esp_err_t player_state_subscribe(TaskHandle_t task)
+{
+    esp_err_t ret = ESP_ERR_NO_MEM;
+
+    portENTER_CRITICAL(&subscribers_lock);
+    int index = atomic_load_explicit(&subscriber_count, memory_order_relaxed);
+    if (index < PLAYER_STATE_MAX_SUBSCRIBERS)
+    {
+        // Publish the handle before making the slot visible to setters
+        subscribers[index] = task;
+        atomic_store_explicit(&subscriber_count, index + 1, memory_order_release);
+        ret = ESP_OK;
+    }
+    portEXIT_CRITICAL(&subscribers_lock);
+
+    return ret;
+}
+
+const char *player_state_name(player_play_state_t play_state)
+{
+    if (play_state > PLAYER_STATE_PAUSED)
+    {
+        return "UNKNOWN";
+    }
+    return play_state_names[play_state];
+}
+
+void player_state_set_song(uint8_t song_id)
+{
+    player_state_set_field(FIELD_SONG, song_id);
+}
+
+void player_state_set_play_state(player_play_state_t play_state)
+{
+    player_state_set_field(FIELD_PLAY_STATE, (uint8_t)play_state);
+}
+
+void player_state_set_volume(int volume)
+{
+    // Same clamping as es8311_set_voice_volume()
+    if (volume < 0)
+    {
+        volume = 0;
+    }
+    else if (volume > 100)
+    {
+        volume = 100;
+    }
+    player_state_set_field(FIELD_VOLUME, (uint8_t)volume);
+}
+
+void player_state_set_position(uint32_t position)
+{
+    atomic_store_explicit(&position_ms, position, memory_order_relaxed);
+}
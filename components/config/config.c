@@ -1,135 +1,450 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "config.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "esp_log.h"
 #include "cJSON.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 
 #define TAG "config"
 #define CONFIG_NAMESPACE "config"
+/*!< 8 registered at boot, the rest is headroom for new subscribers */
+#define CONFIG_MAX_SUBSCRIBERS 16
+/*!< Writes arriving within this window after the first share one commit */
+#define CONFIG_COMMIT_DELAY_MS 200
 
-esp_err_t config_set_value(const char *key, const char *value)
+typedef struct
 {
-    nvs_handle_t config_handle;
-    esp_err_t err;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    char *value;
+    bool dirty;
+} config_entry_t;
+
+typedef struct
+{
+    const char *key;
+    config_change_cb_t cb;
+    void *arg;
+} config_subscriber_t;
+
+static config_entry_t entries[CONFIG_MAX_ENTRIES];
+static int entry_count = 0;
+static config_subscriber_t subscribers[CONFIG_MAX_SUBSCRIBERS];
+static int subscriber_count = 0;
+/*!< Serialized form of `entries`, rebuilt on the first read after a change */
+static char *json_cache = NULL;
+
+static SemaphoreHandle_t config_lock = NULL;
+static TaskHandle_t commit_task_handle = NULL;
+
+static config_entry_t *find_entry(const char *key)
+{
+    for (int i = 0; i < entry_count; i++)
+    {
+        if (strcmp(entries[i].key, key) == 0)
+        {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+static void invalidate_json(void)
+{
+    free(json_cache);
+    json_cache = NULL;
+}
 
-    // Open NVS namespace
-    err = nvs_open(CONFIG_NAMESPACE, NVS_READWRITE, &config_handle);
+static esp_err_t config_load(void)
+{
+    nvs_handle_t config_handle;
+    esp_err_t err = nvs_open(CONFIG_NAMESPACE, NVS_READONLY, &config_handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+    {
+        // Nothing saved yet
+        return ESP_OK;
+    }
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
         return err;
     }
 
-    // Set the key-value pair
-    err = nvs_set_str(config_handle, key, value);
+    nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, CONFIG_NAMESPACE, NVS_TYPE_STR);
+    while (it != NULL && entry_count < CONFIG_MAX_ENTRIES)
+    {
+        nvs_entry_info_t info;
+        nvs_entry_info(it, &info);
+        it = nvs_entry_next(it);
+
+        size_t required_size;
+        if (nvs_get_str(config_handle, info.key, NULL, &required_size) != ESP_OK)
+        {
+            continue;
+        }
+
+        char *value = malloc(required_size);
+        if (value == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to allocate memory for value");
+            break;
+        }
+        if (nvs_get_str(config_handle, info.key, value, &required_size) != ESP_OK)
+        {
+            free(value);
+            continue;
+        }
+
+        config_entry_t *entry = &entries[entry_count++];
+        snprintf(entry->key, sizeof(entry->key), "%s", info.key);
+        entry->value = value;
+        entry->dirty = false;
+    }
+    nvs_release_iterator(it);
+
+    nvs_close(config_handle);
+    ESP_LOGI(TAG, "Loaded %d keys", entry_count);
+    return ESP_OK;
+}
+
+esp_err_t config_commit(void)
+{
+    nvs_handle_t config_handle;
+    esp_err_t err = nvs_open(CONFIG_NAMESPACE, NVS_READWRITE, &config_handle);
     if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "Error (%s) setting value for key %s!", esp_err_to_name(err), key);
-        nvs_close(config_handle);
+        ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
         return err;
     }
 
-    // Commit the changes
-    err = nvs_commit(config_handle);
+    // Held through the commit, so a key changed meanwhile stays dirty
+    int written = 0;
+    xSemaphoreTake(config_lock, portMAX_DELAY);
+    for (int i = 0; i < entry_count && err == ESP_OK; i++)
+    {
+        if (!entries[i].dirty)
+        {
+            continue;
+        }
+
+        err = nvs_set_str(config_handle, entries[i].key, entries[i].value);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error (%s) setting value for key %s!", esp_err_to_name(err), entries[i].key);
+            break;
+        }
+        written++;
+    }
+
+    // One commit for the whole burst, none if any key failed; everything
+    // stays dirty then and the next commit writes it all again
+    if (err == ESP_OK && written > 0)
+    {
+        err = nvs_commit(config_handle);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error (%s) committing changes!", esp_err_to_name(err));
+        }
+        else
+        {
+            for (int i = 0; i < entry_count; i++)
+            {
+                entries[i].dirty = false;
+            }
+            ESP_LOGI(TAG, "Committed %d keys", written);
+        }
+    }
+    xSemaphoreGive(config_lock);
+
+    nvs_close(config_handle);
+    return err;
+}
+
+static void config_commit_task(void *arg)
+{
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_COMMIT_DELAY_MS));
+        ulTaskNotifyTake(pdTRUE, 0);
+        config_commit();
+    }
+}
+
+esp_err_t config_init(void)
+{
+    if (config_lock != NULL)
+    {
+        return ESP_OK;
+    }
+
+    config_lock = xSemaphoreCreateMutex();
+    if (config_lock == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = config_load();
+
+    if (xTaskCreate(config_commit_task, "config_commit", 3072, NULL, 3, &commit_task_handle) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create commit task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return err;
+}
+
+static void notify_subscribers(const config_kv_t *kvs, const bool *changed, size_t count)
+{
+    config_subscriber_t list[CONFIG_MAX_SUBSCRIBERS];
+
+    xSemaphoreTake(config_lock, portMAX_DELAY);
+    int list_count = subscriber_count;
+    memcpy(list, subscribers, list_count * sizeof(config_subscriber_t));
+    xSemaphoreGive(config_lock);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!changed[i])
+        {
+            continue;
+        }
+        for (int j = 0; j < list_count; j++)
+        {
+            if (list[j].key == NULL || strcmp(list[j].key, kvs[i].key) == 0)
+            {
+                list[j].cb(kvs[i].key, kvs[i].value, list[j].arg);
+            }
+        }
+    }
+}
+
+esp_err_t config_set_values(const config_kv_t *kvs, size_t count)
+{
+    bool changed[CONFIG_MAX_ENTRIES] = {0};
+    char *values[CONFIG_MAX_ENTRIES] = {0};
+    esp_err_t err = ESP_OK;
+
+    if (config_lock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (count == 0 || count > CONFIG_MAX_ENTRIES)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Everything that can fail happens before the table is touched
+    for (size_t i = 0; i < count && err == ESP_OK; i++)
+    {
+        err = config_validate(kvs[i].key, kvs[i].value);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Rejected %s=%s (%s)", kvs[i].key, kvs[i].value, esp_err_to_name(err));
+        }
+        else if ((values[i] = strdup(kvs[i].value)) == NULL)
+        {
+            err = ESP_ERR_NO_MEM;
+        }
+    }
+
+    xSemaphoreTake(config_lock, portMAX_DELAY);
+
+    int new_keys = 0;
+    for (size_t i = 0; i < count && err == ESP_OK; i++)
+    {
+        bool repeated = false;
+        for (size_t j = 0; j < i; j++)
+        {
+            repeated |= strcmp(kvs[i].key, kvs[j].key) == 0;
+        }
+        if (find_entry(kvs[i].key) == NULL && !repeated)
+        {
+            new_keys++;
+        }
+    }
+    if (err == ESP_OK && entry_count + new_keys > CONFIG_MAX_ENTRIES)
+    {
+        ESP_LOGE(TAG, "Config table full");
+        err = ESP_ERR_NO_MEM;
+    }
+
+    for (size_t i = 0; i < count && err == ESP_OK; i++)
+    {
+        config_entry_t *entry = find_entry(kvs[i].key);
+        if (entry != NULL && strcmp(entry->value, values[i]) == 0)
+        {
+            // Unchanged, don't wear the flash or wake subscribers
+            continue;
+        }
+        if (entry == NULL)
+        {
+            entry = &entries[entry_count++];
+            snprintf(entry->key, sizeof(entry->key), "%s", kvs[i].key);
+            entry->value = NULL;
+        }
+
+        free(entry->value);
+        entry->value = values[i];
+        entry->dirty = true;
+        values[i] = NULL;
+        changed[i] = true;
+    }
+
+    bool any_changed = false;
+    for (size_t i = 0; i < count; i++)
+    {
+        any_changed |= changed[i];
+    }
+    if (any_changed)
+    {
+        invalidate_json();
+    }
+
+    xSemaphoreGive(config_lock);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        free(values[i]);
+    }
+
     if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "Error (%s) committing changes!", esp_err_to_name(err));
-        nvs_close(config_handle);
         return err;
     }
 
-    nvs_close(config_handle);
-    ESP_LOGI(TAG, "Successfully set value for key %s", key);
+    if (any_changed)
+    {
+        xTaskNotifyGive(commit_task_handle);
+        notify_subscribers(kvs, changed, count);
+    }
+
     return ESP_OK;
 }
 
-char *config_get_all_as_json(void)
+esp_err_t config_set_value(const char *key, const char *value)
 {
-    nvs_handle_t config_handle;
-    esp_err_t err;
-    char *json_string = NULL;
-    size_t required_size;
-    char *value;
+    config_kv_t kv = {.key = key, .value = value};
+    esp_err_t err = config_set_values(&kv, 1);
 
-    // Open NVS namespace
-    err = nvs_open(CONFIG_NAMESPACE, NVS_READONLY, &config_handle);
-    if (err != ESP_OK)
+    if (err == ESP_OK)
     {
-        ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
-        return NULL;
+        ESP_LOGI(TAG, "Successfully set value for key %s", key);
+    }
+    return err;
+}
+
+esp_err_t config_get_value(const char *key, char *value, size_t len)
+{
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+
+    if (config_lock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(config_lock, portMAX_DELAY);
+    config_entry_t *entry = find_entry(key);
+    if (entry != NULL)
+    {
+        err = snprintf(value, len, "%s", entry->value) < len ? ESP_OK : ESP_ERR_INVALID_SIZE;
+    }
+    xSemaphoreGive(config_lock);
+
+    const config_schema_t *schema = config_schema_find(key);
+    if (err == ESP_ERR_NOT_FOUND && schema != NULL && schema->default_value != NULL)
+    {
+        err = snprintf(value, len, "%s", schema->default_value) < len ? ESP_OK : ESP_ERR_INVALID_SIZE;
+    }
+
+    return err;
+}
+
+esp_err_t config_subscribe(const char *key, config_change_cb_t cb, void *arg)
+{
+    esp_err_t err = ESP_ERR_NO_MEM;
+
+    if (config_lock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
     }
 
-    // Create JSON root object
+    xSemaphoreTake(config_lock, portMAX_DELAY);
+    if (subscriber_count < CONFIG_MAX_SUBSCRIBERS)
+    {
+        subscribers[subscriber_count].key = key;
+        subscribers[subscriber_count].cb = cb;
+        subscribers[subscriber_count].arg = arg;
+        subscriber_count++;
+        err = ESP_OK;
+    }
+    xSemaphoreGive(config_lock);
+
+    return err;
+}
+
+static char *build_json(void)
+{
     cJSON *root = cJSON_CreateObject();
     if (root == NULL)
     {
         ESP_LOGE(TAG, "Failed to create JSON root object");
-        nvs_close(config_handle);
         return NULL;
     }
 
-    // Iterate over all keys in the namespace
-    nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, CONFIG_NAMESPACE, NVS_TYPE_STR);
-    while (it != NULL)
+    // Typed where the schema says so, plain strings for anything else
+    for (int i = 0; i < entry_count; i++)
     {
-        nvs_entry_info_t info;
-        nvs_entry_info(it, &info);
+        const config_schema_t *schema = config_schema_find(entries[i].key);
+        config_type_t type = schema != NULL ? schema->type : CONFIG_TYPE_STRING;
 
-        // Get the value size
-        err = nvs_get_str(config_handle, info.key, NULL, &required_size);
-        if (err != ESP_OK)
+        if (type == CONFIG_TYPE_INT && config_validate(entries[i].key, entries[i].value) == ESP_OK)
         {
-            ESP_LOGE(TAG, "Error (%s) getting size for key %s", esp_err_to_name(err), info.key);
-            cJSON_Delete(root);
-            nvs_close(config_handle);
-            return NULL;
+            cJSON_AddNumberToObject(root, entries[i].key, atoi(entries[i].value));
         }
-
-        // Allocate memory for the value
-        value = malloc(required_size);
-        if (value == NULL)
+        else if (type == CONFIG_TYPE_BOOL)
         {
-            ESP_LOGE(TAG, "Failed to allocate memory for value");
-            cJSON_Delete(root);
-            nvs_close(config_handle);
-            return NULL;
+            cJSON_AddBoolToObject(root, entries[i].key, strcmp(entries[i].value, "true") == 0);
         }
-
-        // Get the value
-        err = nvs_get_str(config_handle, info.key, value, &required_size);
-        if (err != ESP_OK)
+        else
         {
-            ESP_LOGE(TAG, "Error (%s) getting value for key %s", esp_err_to_name(err), info.key);
-            free(value);
-            cJSON_Delete(root);
-            nvs_close(config_handle);
-            return NULL;
+            cJSON_AddStringToObject(root, entries[i].key, entries[i].value);
         }
+    }
 
-        // Add the key-value pair to the JSON object
-        cJSON_AddStringToObject(root, info.key, value);
+    char *json_string = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    return json_string;
+}
 
-        // Free the allocated memory
-        free(value);
+char *config_get_all_as_json(void)
+{
+    char *json_string = NULL;
 
-        // Move to the next entry
-        it = nvs_entry_next(it);
+    if (config_lock == NULL)
+    {
+        return NULL;
+    }
+
+    xSemaphoreTake(config_lock, portMAX_DELAY);
+    if (json_cache == NULL)
+    {
+        json_cache = build_json();
+    }
+    if (json_cache != NULL)
+    {
+        json_string = strdup(json_cache);
     }
+    xSemaphoreGive(config_lock);
 
-    // Convert JSON object to string
-    json_string = cJSON_Print(root);
     if (json_string == NULL)
     {
         ESP_LOGE(TAG, "Failed to print JSON");
-        cJSON_Delete(root);
-        nvs_close(config_handle);
-        return NULL;
     }
-
-    // Cleanup
-    cJSON_Delete(root);
-    nvs_close(config_handle);
-
     return json_string;
 }
@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "sdkconfig.h"
+#include "config.h"
+
+#define XSTR(x) #x
+#define STR(x) XSTR(x)
+
+static const char *const log_levels[] = {"none", "error", "warn", "info", "debug", "verbose", NULL};
+
+/*!< Every setting the device knows about */
+static const config_schema_t schema[] = {
+    {"ssid", CONFIG_TYPE_STRING, 0, 31, NULL, NULL},
+    {"password", CONFIG_TYPE_STRING, 0, 63, NULL, NULL},
+    {"broker", CONFIG_TYPE_STRING, 1, 255, NULL, NULL},
+    {"topic", CONFIG_TYPE_STRING, 1, 127, NULL, NULL},
+    {"tlm_topic", CONFIG_TYPE_STRING, 1, 127, NULL, CONFIG_MQTT_TELEMETRY_TOPIC},
+    {"tlm_interval", CONFIG_TYPE_INT, 500, 3600000, NULL, STR(CONFIG_MQTT_TELEMETRY_INTERVAL_MS)},
+    {"tlm_enabled", CONFIG_TYPE_BOOL, 0, 0, NULL, "true"},
+    {"log_level", CONFIG_TYPE_ENUM, 0, 0, log_levels, "info"},
+};
+
+const config_schema_t *config_schema_find(const char *key)
+{
+    for (int i = 0; i < sizeof(schema) / sizeof(schema[0]); i++)
+    {
+        if (strcmp(schema[i].key, key) == 0)
+        {
+            return &schema[i];
+        }
+    }
+    return NULL;
+}
+
+/*!< Whole string must be a decimal integer that fits in int32_t */
+static bool parse_int(const char *value, int32_t *out)
+{
+    char *end;
+
+    errno = 0;
+    long parsed = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || errno != 0 || parsed < INT32_MIN || parsed > INT32_MAX)
+    {
+        return false;
+    }
+
+    *out = parsed;
+    return true;
+}
+
+esp_err_t config_validate(const char *key, const char *value)
+{
+    const config_schema_t *entry = config_schema_find(key);
+    if (entry == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    switch (entry->type)
+    {
+    case CONFIG_TYPE_STRING:
+    {
+        size_t len = strlen(value);
+        return len >= entry->min && len <= entry->max ? ESP_OK : ESP_ERR_INVALID_ARG;
+    }
+    case CONFIG_TYPE_INT:
+    {
+        int32_t parsed;
+        return parse_int(value, &parsed) && parsed >= entry->min && parsed <= entry->max ? ESP_OK : ESP_ERR_INVALID_ARG;
+    }
+    case CONFIG_TYPE_BOOL:
+        return strcmp(value, "true") == 0 || strcmp(value, "false") == 0 ? ESP_OK : ESP_ERR_INVALID_ARG;
+    case CONFIG_TYPE_ENUM:
+        for (const char *const *option = entry->options; *option != NULL; option++)
+        {
+            if (strcmp(*option, value) == 0)
+            {
+                return ESP_OK;
+            }
+        }
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t config_get_int(const char *key, int32_t *value)
+{
+    char buf[16];
+    esp_err_t err = config_get_value(key, buf, sizeof(buf));
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    return parse_int(buf, value) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t config_get_bool(const char *key, bool *value)
+{
+    char buf[8];
+    esp_err_t err = config_get_value(key, buf, sizeof(buf));
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    *value = strcmp(buf, "true") == 0;
+    return ESP_OK;
+}
@@ -1,9 +1,93 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "esp_err.h"
 
+/*
+ * Key/value settings, loaded from NVS into RAM by config_init(). Reads are
+ * served from RAM; writes update RAM, notify subscribers and are committed
+ * to flash shortly after by a background task, several writes in one commit.
+ */
+
+#define CONFIG_MAX_ENTRIES 32
+
+typedef enum
+{
+    CONFIG_TYPE_STRING,
+    CONFIG_TYPE_INT,
+    CONFIG_TYPE_BOOL, /*!< stored as "true" / "false" */
+    CONFIG_TYPE_ENUM,
+} config_type_t;
+
+/*!< One known key, values are stored as strings and checked against this */
+typedef struct
+{
+    const char *key;
+    config_type_t type;
+    int32_t min;                 /*!< int: lowest value, string: shortest length */
+    int32_t max;                 /*!< int: highest value, string: longest length */
+    const char *const *options;  /*!< enum: NULL terminated list of allowed values */
+    const char *default_value;   /*!< returned by the getters when unset, may be NULL */
+} config_schema_t;
+
+typedef struct
+{
+    const char *key;
+    const char *value;
+} config_kv_t;
+
+/*!< Called after `key` changed, from the task that changed it */
+typedef void (*config_change_cb_t)(const char *key, const char *value, void *arg);
+
+esp_err_t config_init(void);
+
 esp_err_t config_set_value(const char *key, const char *value);
+
+/**
+ * @brief Set several keys at once. Either all of them are applied or none;
+ *        subscribers are notified once every key is in place.
+ *
+ * @return - ESP_OK on success
+ *         - ESP_ERR_NOT_FOUND if a key isn't in the schema
+ *         - ESP_ERR_INVALID_ARG if a value doesn't match its schema entry
+ *         - ESP_ERR_NO_MEM if the table is full or out of heap
+ */
+esp_err_t config_set_values(const config_kv_t *kvs, size_t count);
+
+/**
+ * @return - ESP_OK on success, the schema default if the key isn't set
+ *         - ESP_ERR_NOT_FOUND if the key isn't set and has no default
+ *         - ESP_ERR_INVALID_SIZE if `value` is too small
+ */
+esp_err_t config_get_value(const char *key, char *value, size_t len);
+esp_err_t config_get_int(const char *key, int32_t *value);
+esp_err_t config_get_bool(const char *key, bool *value);
+
+/*!< NULL if `key` isn't a known setting */
+const config_schema_t *config_schema_find(const char *key);
+
+/**
+ * @brief Check `value` against the schema entry of `key`
+ *
+ * @return - ESP_OK if it may be stored
+ *         - ESP_ERR_NOT_FOUND for an unknown key
+ *         - ESP_ERR_INVALID_ARG for a value of the wrong type or out of range
+ */
+esp_err_t config_validate(const char *key, const char *value);
+
+/*!< All keys as a JSON object, the caller frees the string */
 char *config_get_all_as_json(void);
 
+/**
+ * @brief Get a callback when `key` changes, or any key if `key` is NULL.
+ *        `key` must stay valid, a string literal in practice.
+ */
+esp_err_t config_subscribe(const char *key, config_change_cb_t cb, void *arg);
+
+/*!< Write pending changes to NVS now instead of waiting for the commit task */
+esp_err_t config_commit(void);
+
 #endif // CONFIG_H
@@ -14,6 +14,7 @@
 
 #include <string.h>
 #include "es8311.h"
+#include "freertos/FreeRTOS.h"
 //#include "driver/i2c.h"
 #include "driver/gpio.h"
 #include "i2c_bus.h"
@@ -74,6 +75,7 @@ static const struct _coeff_div coeff_div[] = {
     {2048000, 8000, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0xff, 0x04, 0x10, 0x10},
     {1536000, 8000, 0x03, 0x04, 0x01, 0x01, 0x00, 0x00, 0xff, 0x04, 0x10, 0x10},
     {1024000, 8000, 0x01, 0x02, 0x01, 0x01, 0x00, 0x00, 0xff, 0x04, 0x10, 0x10},
+    {256000, 8000, 0x01, 0x08, 0x01, 0x01, 0x00, 0x00, 0xff, 0x04, 0x10, 0x10}, /*!< MCLK from SCLK, 32 fs */
 
     /* 11.025k */
     {11289600, 11025, 0x04, 0x01, 0x01, 0x01, 0x00, 0x00, 0xff, 0x04, 0x10, 0x10},
@@ -165,24 +167,255 @@ static const struct _coeff_div coeff_div[] = {
 
 static char *TAG = "DRV8311";
 
+/*!< Rate the clock manager is currently programmed for, 0 before init */
+static int current_rate = 0;
+
 #define ES_ASSERT(a, format, b, ...) \
     if ((a) != 0) { \
         ESP_LOGE(TAG, format, ##__VA_ARGS__); \
         return b;\
     }
 
+/*
+ * Write-through shadow of the control registers (0x00 ~ 0x49). A register
+ * is read over I2C at most once; afterwards reads are served from here and
+ * writes of an unchanged value are dropped. Dirty marks a register whose
+ * last write did not reach the chip, es8311_cache_sync() retries those.
+ */
+#define ES8311_CACHE_REGS   0x4A
+#define ES8311_SYNC_MAX     16
+
+static uint8_t reg_cache[ES8311_CACHE_REGS];
+static uint8_t reg_valid[(ES8311_CACHE_REGS + 7) / 8];
+static uint8_t reg_dirty[(ES8311_CACHE_REGS + 7) / 8];
+static portMUX_TYPE cache_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#define CACHE_TEST(map, reg)    ((map)[(reg) >> 3] & (1 << ((reg) & 7)))
+#define CACHE_SET(map, reg)     ((map)[(reg) >> 3] |= (1 << ((reg) & 7)))
+#define CACHE_CLR(map, reg)     ((map)[(reg) >> 3] &= ~(1 << ((reg) & 7)))
+
+static void es8311_cache_invalidate(void)
+{
+    portENTER_CRITICAL(&cache_lock);
+    memset(reg_valid, 0, sizeof(reg_valid));
+    memset(reg_dirty, 0, sizeof(reg_dirty));
+    portEXIT_CRITICAL(&cache_lock);
+}
+
+/*!< Record `data` as the value of `reg_addr`, true if the chip needs the write */
+static bool es8311_cache_update(uint8_t reg_addr, uint8_t data)
+{
+    bool changed = true;
+
+    if (reg_addr >= ES8311_CACHE_REGS) {
+        return true;
+    }
+
+    portENTER_CRITICAL(&cache_lock);
+    if (CACHE_TEST(reg_valid, reg_addr) && !CACHE_TEST(reg_dirty, reg_addr) && reg_cache[reg_addr] == data) {
+        changed = false;
+    } else {
+        reg_cache[reg_addr] = data;
+        CACHE_SET(reg_valid, reg_addr);
+        CACHE_SET(reg_dirty, reg_addr);
+    }
+    portEXIT_CRITICAL(&cache_lock);
+
+    return changed;
+}
+
+static void es8311_cache_mark(const i2c_bus_reg_t *regs, size_t count, bool clean)
+{
+    portENTER_CRITICAL(&cache_lock);
+    for (size_t i = 0; i < count; i++) {
+        if (regs[i].reg >= ES8311_CACHE_REGS) {
+            continue;
+        }
+        if (clean) {
+            CACHE_CLR(reg_dirty, regs[i].reg);
+        } else {
+            CACHE_SET(reg_dirty, regs[i].reg);
+        }
+    }
+    portEXIT_CRITICAL(&cache_lock);
+}
+
+static int es8311_bus_write(const i2c_bus_reg_t *regs, size_t count)
+{
+    if (count == 0) {
+        return ESP_OK;
+    }
+
+    int ret = i2c_bus_write_regs(ES8311_ADDR, regs, count);
+    es8311_cache_mark(regs, count, ret == ESP_OK);
+    return ret;
+}
+
+static int es8311_write_regs(const i2c_bus_reg_t *regs, size_t count)
+{
+    i2c_bus_reg_t changed[ES8311_SYNC_MAX];
+    size_t n = 0;
+    int ret = ESP_OK;
+
+    for (size_t i = 0; i < count; i++) {
+        if (!es8311_cache_update(regs[i].reg, regs[i].data)) {
+            continue;
+        }
+
+        changed[n++] = regs[i];
+        if (n == ES8311_SYNC_MAX) {
+            ret |= es8311_bus_write(changed, n);
+            n = 0;
+        }
+    }
+
+    ret |= es8311_bus_write(changed, n);
+    return ret;
+}
+
 static int es8311_write_reg(uint8_t reg_addr, uint8_t data)
 {
-    return i2c_bus_write_reg(ES8311_ADDR, reg_addr, data);
+    i2c_bus_reg_t reg = { .reg = reg_addr, .data = data };
+    return es8311_write_regs(&reg, 1);
 }
 
 int es8311_read_reg(uint8_t reg_addr)
 {
     uint8_t data;
-    i2c_bus_read_reg(ES8311_ADDR, reg_addr, &data);
+
+    if (reg_addr < ES8311_CACHE_REGS) {
+        portENTER_CRITICAL(&cache_lock);
+        bool valid = CACHE_TEST(reg_valid, reg_addr);
+        data = reg_cache[reg_addr];
+        portEXIT_CRITICAL(&cache_lock);
+
+        if (valid) {
+            return (int)data;
+        }
+    }
+
+    if (i2c_bus_read_reg(ES8311_ADDR, reg_addr, &data) != ESP_OK) {
+        return -1;
+    }
+
+    if (reg_addr < ES8311_CACHE_REGS) {
+        portENTER_CRITICAL(&cache_lock);
+        if (!CACHE_TEST(reg_valid, reg_addr)) {
+            reg_cache[reg_addr] = data;
+            CACHE_SET(reg_valid, reg_addr);
+        }
+        portEXIT_CRITICAL(&cache_lock);
+    }
+
     return (int)data;
 }
 
+esp_err_t es8311_cache_sync(bool all)
+{
+    i2c_bus_reg_t regs[ES8311_SYNC_MAX];
+    size_t n = 0;
+    int ret = ESP_OK;
+
+    /*!< clocks and routing first, RESET_REG00 (state machine on) last */
+    for (int i = 1; i <= ES8311_CACHE_REGS; i++) {
+        uint8_t reg_addr = i % ES8311_CACHE_REGS;
+
+        portENTER_CRITICAL(&cache_lock);
+        bool pending = CACHE_TEST(reg_valid, reg_addr) && (all || CACHE_TEST(reg_dirty, reg_addr));
+        uint8_t data = reg_cache[reg_addr];
+        portEXIT_CRITICAL(&cache_lock);
+
+        if (!pending) {
+            continue;
+        }
+
+        regs[n].reg = reg_addr;
+        regs[n].data = data;
+        if (++n == ES8311_SYNC_MAX) {
+            ret |= es8311_bus_write(regs, n);
+            n = 0;
+        }
+    }
+
+    ret |= es8311_bus_write(regs, n);
+    return ret ? ESP_FAIL : ESP_OK;
+}
+
+/*
+ * Register writes queued up to go out as one bus transaction. Reads of a
+ * register with a pending write are answered from the queue, so the
+ * read-modify-write steps below see the same values as when every write
+ * went out on its own.
+ */
+#define ES8311_SEQ_MAX      40
+
+typedef struct {
+    i2c_bus_reg_t regs[ES8311_SEQ_MAX];
+    size_t count;
+} es8311_seq_t;
+
+static int es8311_seq_flush(es8311_seq_t *seq)
+{
+    int ret = es8311_write_regs(seq->regs, seq->count);
+    seq->count = 0;
+    return ret;
+}
+
+static int es8311_seq_write(es8311_seq_t *seq, uint8_t reg_addr, uint8_t data)
+{
+    int ret = ESP_OK;
+
+    if (seq->count == ES8311_SEQ_MAX) {
+        ret = es8311_seq_flush(seq);
+    }
+
+    seq->regs[seq->count].reg = reg_addr;
+    seq->regs[seq->count].data = data;
+    seq->count++;
+    return ret;
+}
+
+static int es8311_seq_read(const es8311_seq_t *seq, uint8_t reg_addr)
+{
+    for (size_t i = seq->count; i > 0; i--) {
+        if (seq->regs[i - 1].reg == reg_addr) {
+            return seq->regs[i - 1].data;
+        }
+    }
+
+    return es8311_read_reg(reg_addr);
+}
+
+/*!< Power-on defaults, written before the mode and clock setup */
+static const i2c_bus_reg_t es8311_reset_seq[] = {
+    {ES8311_GP_REG45, 0x00},
+    {ES8311_CLK_MANAGER_REG01, 0x30},
+    {ES8311_CLK_MANAGER_REG02, 0x00},
+    {ES8311_CLK_MANAGER_REG03, 0x10},
+    {ES8311_ADC_REG16, 0x24},
+    {ES8311_CLK_MANAGER_REG04, 0x10},
+    {ES8311_CLK_MANAGER_REG05, 0x00},
+    {ES8311_SYSTEM_REG0B, 0x00},
+    {ES8311_SYSTEM_REG0C, 0x00},
+    {ES8311_SYSTEM_REG10, 0x1F},
+    {ES8311_SYSTEM_REG11, 0x7F},
+    {ES8311_RESET_REG00, 0x80},
+};
+
+/*!< Analog / DAC setup written last, once the interface is configured */
+static const i2c_bus_reg_t es8311_start_seq[] = {
+    {ES8311_SYSTEM_REG12, 0x00},
+    {ES8311_SYSTEM_REG13, 0x10},
+    {ES8311_SYSTEM_REG0E, 0x02},
+    {ES8311_ADC_REG15, 0x40},
+    {ES8311_ADC_REG1B, 0x0A},
+    {ES8311_ADC_REG1C, 0x6A},
+    {ES8311_DAC_REG37, 0x48},
+    {ES8311_GPIO_REG44, 0x08},
+    {ES8311_ADC_REG17, 0xBF},
+    {ES8311_DAC_REG32, 0xBF},
+};
+
 
 /*
 * look for the coefficient in coeff_div[] table
@@ -216,25 +449,86 @@ void es8311_set_tristate(int tristate)
     }
 }
 
+/*
+ * Registers changed to enter standby, in the order they are written. The
+ * previous values are kept and written back in reverse order on wake, so
+ * the DAC is unmuted last. DAC_REG32 (volume) is left alone so volume
+ * changes made while in standby survive.
+ */
+static const i2c_bus_reg_t es8311_standby_seq[] = {
+    {ES8311_DAC_REG31, 0x60},   /*!< OR-ed in: DAC soft mute */
+    {ES8311_ADC_REG17, 0x00},
+    {ES8311_SYSTEM_REG0E, 0xFF},
+    {ES8311_SYSTEM_REG12, 0x02},
+    {ES8311_SYSTEM_REG14, 0x00},
+    {ES8311_SYSTEM_REG0D, 0xFA},
+    {ES8311_ADC_REG15, 0x00},
+    {ES8311_DAC_REG37, 0x08},
+    {ES8311_GP_REG45, 0x01},
+};
+
+#define ES8311_STANDBY_REGS (sizeof(es8311_standby_seq) / sizeof(es8311_standby_seq[0]))
+
+static uint8_t standby_saved[ES8311_STANDBY_REGS];
+static bool in_standby = false;
+
+/*!< Index of `reg` in es8311_standby_seq, -1 if standby leaves it alone */
+static int es8311_standby_slot(uint8_t reg)
+{
+    for (int i = 0; i < ES8311_STANDBY_REGS; i++) {
+        if (es8311_standby_seq[i].reg == reg) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*!< Value `reg` has while awake, the saved copy while in standby */
+static int es8311_read_awake(uint8_t reg)
+{
+    int slot = in_standby ? es8311_standby_slot(reg) : -1;
+
+    return slot < 0 ? es8311_read_reg(reg) : standby_saved[slot];
+}
+
 /*
 * set es8311 dac mute or not
 * if mute = 0, dac un-mute
 * if mute = 1, dac mute
+* In standby the registers standby owns are changed in standby_saved, so
+* the change takes effect on wake instead of being overwritten by it.
 */
 static void es8311_mute(int mute)
 {
     uint8_t regv;
+    i2c_bus_reg_t regs[4];
+    int count = 0;
     ESP_LOGI(TAG, "Enter into es8311_mute(), mute = %d\n", mute);
-    regv = es8311_read_reg(ES8311_DAC_REG31) & 0x9f;
-
-    if (mute) {
-        es8311_write_reg(ES8311_SYSTEM_REG12, 0x02);
-        es8311_write_reg(ES8311_DAC_REG31, regv | 0x60);
-        es8311_write_reg(ES8311_DAC_REG32, 0x00);
-        es8311_write_reg(ES8311_DAC_REG37, 0x08);
-    } else {
-        es8311_write_reg(ES8311_DAC_REG31, regv);
-        es8311_write_reg(ES8311_SYSTEM_REG12, 0x00);
+    regv = es8311_read_awake(ES8311_DAC_REG31) & 0x9f;
+
+    const i2c_bus_reg_t mute_seq[] = {
+        {ES8311_SYSTEM_REG12, 0x02},
+        {ES8311_DAC_REG31, regv | 0x60},
+        {ES8311_DAC_REG32, 0x00},
+        {ES8311_DAC_REG37, 0x08},
+    };
+    const i2c_bus_reg_t unmute_seq[] = {
+        {ES8311_DAC_REG31, regv},
+        {ES8311_SYSTEM_REG12, 0x00},
+    };
+    const i2c_bus_reg_t *seq = mute ? mute_seq : unmute_seq;
+    int seq_len = mute ? sizeof(mute_seq) / sizeof(mute_seq[0]) : sizeof(unmute_seq) / sizeof(unmute_seq[0]);
+
+    for (int i = 0; i < seq_len; i++) {
+        int slot = in_standby ? es8311_standby_slot(seq[i].reg) : -1;
+        if (slot >= 0) {
+            standby_saved[slot] = seq[i].data;
+        } else {
+            regs[count++] = seq[i];
+        }
+    }
+    if (count > 0) {
+        es8311_write_regs(regs, count);
     }
 }
 
@@ -257,6 +551,78 @@ static void es8311_pa_power(bool enable)
     }
 }
 
+/*
+ * Queue the clock manager registers (REG02 ~ REG08) for coeff_div[coeff],
+ * keeping the bits that are not part of the divider setup.
+ */
+static int es8311_seq_clock(es8311_seq_t *seq, int coeff)
+{
+    uint8_t regv, datmp;
+    int ret = ESP_OK;
+
+    regv = es8311_seq_read(seq, ES8311_CLK_MANAGER_REG02) & 0x07;
+    regv |= (coeff_div[coeff].pre_div - 1) << 5;
+    datmp = 0;
+
+    switch (coeff_div[coeff].pre_multi) {
+        case 1:
+            datmp = 0;
+            break;
+
+        case 2:
+            datmp = 1;
+            break;
+
+        case 4:
+            datmp = 2;
+            break;
+
+        case 8:
+            datmp = 3;
+            break;
+
+        default:
+            break;
+    }
+
+    regv |= (datmp) << 3;
+    ret |= es8311_seq_write(seq, ES8311_CLK_MANAGER_REG02, regv);
+
+    regv = es8311_seq_read(seq, ES8311_CLK_MANAGER_REG05) & 0x00;
+    regv |= (coeff_div[coeff].adc_div - 1) << 4;
+    regv |= (coeff_div[coeff].dac_div - 1) << 0;
+    ret |= es8311_seq_write(seq, ES8311_CLK_MANAGER_REG05, regv);
+
+    regv = es8311_seq_read(seq, ES8311_CLK_MANAGER_REG03) & 0x80;
+    regv |= coeff_div[coeff].fs_mode << 6;
+    regv |= coeff_div[coeff].adc_osr << 0;
+    ret |= es8311_seq_write(seq, ES8311_CLK_MANAGER_REG03, regv);
+
+    regv = es8311_seq_read(seq, ES8311_CLK_MANAGER_REG04) & 0x80;
+    regv |= coeff_div[coeff].dac_osr << 0;
+    ret |= es8311_seq_write(seq, ES8311_CLK_MANAGER_REG04, regv);
+
+    regv = es8311_seq_read(seq, ES8311_CLK_MANAGER_REG07) & 0xC0;
+    regv |= coeff_div[coeff].lrck_h << 0;
+    ret |= es8311_seq_write(seq, ES8311_CLK_MANAGER_REG07, regv);
+
+    regv = es8311_seq_read(seq, ES8311_CLK_MANAGER_REG08) & 0x00;
+    regv |= coeff_div[coeff].lrck_l << 0;
+    ret |= es8311_seq_write(seq, ES8311_CLK_MANAGER_REG08, regv);
+
+    regv = es8311_seq_read(seq, ES8311_CLK_MANAGER_REG06) & 0xE0;
+
+    if (coeff_div[coeff].bclk_div < 19) {
+        regv |= (coeff_div[coeff].bclk_div - 1) << 0;
+    } else {
+        regv |= (coeff_div[coeff].bclk_div) << 0;
+    }
+
+    ret |= es8311_seq_write(seq, ES8311_CLK_MANAGER_REG06, regv);
+
+    return ret;
+}
+
 esp_err_t es8311_init(int sample_fre)
 {
     if (sample_fre <= 8000) {
@@ -264,24 +630,20 @@ esp_err_t es8311_init(int sample_fre)
         return ESP_FAIL;
     }
 
-    uint8_t adc_iface, dac_iface, datmp, regv;
+    uint8_t adc_iface, dac_iface, regv;
     int coeff;
     esp_err_t ret = ESP_OK;
+    es8311_seq_t seq = { .count = 0 };
+
+    /*!< nothing is known about the chip until the reset sequence is in */
+    es8311_cache_invalidate();
 
 // gpio_matrix_out(IIS_MCLK, CLK_I2S_MUX_IDX, 0, 0);
 
-    ret |= es8311_write_reg(ES8311_GP_REG45, 0x00);
-    ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG01, 0x30);
-    ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG02, 0x00);
-    ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG03, 0x10);
-    ret |= es8311_write_reg(ES8311_ADC_REG16, 0x24);
-    ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG04, 0x10);
-    ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG05, 0x00);
-    ret |= es8311_write_reg(ES8311_SYSTEM_REG0B, 0x00);
-    ret |= es8311_write_reg(ES8311_SYSTEM_REG0C, 0x00);
-    ret |= es8311_write_reg(ES8311_SYSTEM_REG10, 0x1F);
-    ret |= es8311_write_reg(ES8311_SYSTEM_REG11, 0x7F);
-    ret |= es8311_write_reg(ES8311_RESET_REG00, 0x80);
+    /*!< The ES8311 control port is rated for fast mode */
+    i2c_bus_set_device_speed(ES8311_ADDR, I2C_BUS_FAST_CLK_HZ);
+
+    ret |= es8311_write_regs(es8311_reset_seq, sizeof(es8311_reset_seq) / sizeof(es8311_reset_seq[0]));
 
     /*
      * Set Codec into Master or Slave mode
@@ -293,30 +655,30 @@ esp_err_t es8311_init(int sample_fre)
      */
     ESP_LOGI(TAG, "ES8311 in Slave mode\n");
     regv &= 0xBF;
-    ret |= es8311_write_reg(ES8311_RESET_REG00, regv);
-    ret |= es8311_write_reg(ES8311_SYSTEM_REG0D, 0x01);
-    ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG01, 0x3F);
+    ret |= es8311_seq_write(&seq, ES8311_RESET_REG00, regv);
+    ret |= es8311_seq_write(&seq, ES8311_SYSTEM_REG0D, 0x01);
+    ret |= es8311_seq_write(&seq, ES8311_CLK_MANAGER_REG01, 0x3F);
 
     /*
      * Select clock source for internal mclk
      */
     switch (MCLK_SOURCE) {
         case FROM_MCLK_PIN:
-            regv = es8311_read_reg(ES8311_CLK_MANAGER_REG01);
+            regv = es8311_seq_read(&seq, ES8311_CLK_MANAGER_REG01);
             regv &= 0x7F;
-            ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG01, regv);
+            ret |= es8311_seq_write(&seq, ES8311_CLK_MANAGER_REG01, regv);
             break;
 
         case FROM_SCLK_PIN:
-            regv = es8311_read_reg(ES8311_CLK_MANAGER_REG01);
+            regv = es8311_seq_read(&seq, ES8311_CLK_MANAGER_REG01);
             regv |= 0x80;
-            ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG01, regv);
+            ret |= es8311_seq_write(&seq, ES8311_CLK_MANAGER_REG01, regv);
             break;
 
         default:
-            regv = es8311_read_reg(ES8311_CLK_MANAGER_REG01);
+            regv = es8311_seq_read(&seq, ES8311_CLK_MANAGER_REG01);
             regv &= 0x7F;
-            ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG01, regv);
+            ret |= es8311_seq_write(&seq, ES8311_CLK_MANAGER_REG01, regv);
             break;
     }
 
@@ -332,73 +694,14 @@ esp_err_t es8311_init(int sample_fre)
     /*
      * Set clock parammeters
      */
-    if (coeff >= 0) {
-        regv = es8311_read_reg(ES8311_CLK_MANAGER_REG02) & 0x07;
-        regv |= (coeff_div[coeff].pre_div - 1) << 5;
-        datmp = 0;
-
-        switch (coeff_div[coeff].pre_multi) {
-            case 1:
-                datmp = 0;
-                break;
-
-            case 2:
-                datmp = 1;
-                break;
-
-            case 4:
-                datmp = 2;
-                break;
-
-            case 8:
-                datmp = 3;
-                break;
-
-            default:
-                break;
-        }
-
-        regv |= (datmp) << 3;
-        ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG02, regv);
-
-        regv = es8311_read_reg(ES8311_CLK_MANAGER_REG05) & 0x00;
-        regv |= (coeff_div[coeff].adc_div - 1) << 4;
-        regv |= (coeff_div[coeff].dac_div - 1) << 0;
-        ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG05, regv);
-
-        regv = es8311_read_reg(ES8311_CLK_MANAGER_REG03) & 0x80;
-        regv |= coeff_div[coeff].fs_mode << 6;
-        regv |= coeff_div[coeff].adc_osr << 0;
-        ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG03, regv);
-
-        regv = es8311_read_reg(ES8311_CLK_MANAGER_REG04) & 0x80;
-        regv |= coeff_div[coeff].dac_osr << 0;
-        ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG04, regv);
-
-        regv = es8311_read_reg(ES8311_CLK_MANAGER_REG07) & 0xC0;
-        regv |= coeff_div[coeff].lrck_h << 0;
-        ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG07, regv);
-
-        regv = es8311_read_reg(ES8311_CLK_MANAGER_REG08) & 0x00;
-        regv |= coeff_div[coeff].lrck_l << 0;
-        ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG08, regv);
-
-        regv = es8311_read_reg(ES8311_CLK_MANAGER_REG06) & 0xE0;
-
-        if (coeff_div[coeff].bclk_div < 19) {
-            regv |= (coeff_div[coeff].bclk_div - 1) << 0;
-        } else {
-            regv |= (coeff_div[coeff].bclk_div) << 0;
-        }
-
-        ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG06, regv);
-    }
+    ret |= es8311_seq_clock(&seq, coeff);
+    current_rate = sample_fre;
 
     /*
     * DAC/ADC interface, DAC/ADC resolution
     */
-    dac_iface = es8311_read_reg(ES8311_SDPIN_REG09) & 0xC0;
-    adc_iface = es8311_read_reg(ES8311_SDPOUT_REG0A) & 0xC0;
+    dac_iface = es8311_seq_read(&seq, ES8311_SDPIN_REG09) & 0xC0;
+    adc_iface = es8311_seq_read(&seq, ES8311_SDPOUT_REG0A) & 0xC0;
     /* bit size */
     /*!< AUDIO_HAL_BIT_LENGTH_16BITS */
     dac_iface |= 0x0c;
@@ -409,69 +712,140 @@ esp_err_t es8311_init(int sample_fre)
     dac_iface &= 0xFC;
     adc_iface &= 0xFC;
     /* set iface */
-    ret |= es8311_write_reg(ES8311_SDPIN_REG09, dac_iface);
-    ret |= es8311_write_reg(ES8311_SDPOUT_REG0A, adc_iface);
+    ret |= es8311_seq_write(&seq, ES8311_SDPIN_REG09, dac_iface);
+    ret |= es8311_seq_write(&seq, ES8311_SDPOUT_REG0A, adc_iface);
 
     /*
      *   mclk inverted or not
      */
     if (INVERT_MCLK) {
-        regv = es8311_read_reg(ES8311_CLK_MANAGER_REG01);
+        regv = es8311_seq_read(&seq, ES8311_CLK_MANAGER_REG01);
         regv |= 0x40;
-        ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG01, regv);
+        ret |= es8311_seq_write(&seq, ES8311_CLK_MANAGER_REG01, regv);
     } else {
-        regv = es8311_read_reg(ES8311_CLK_MANAGER_REG01);
+        regv = es8311_seq_read(&seq, ES8311_CLK_MANAGER_REG01);
         regv &= ~(0x40);
-        ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG01, regv);
+        ret |= es8311_seq_write(&seq, ES8311_CLK_MANAGER_REG01, regv);
     }
 
     /*
      *   sclk inverted or not
      */
     if (INVERT_SCLK) {
-        regv = es8311_read_reg(ES8311_CLK_MANAGER_REG06);
+        regv = es8311_seq_read(&seq, ES8311_CLK_MANAGER_REG06);
         regv |= 0x20;
-        ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG06, regv);
+        ret |= es8311_seq_write(&seq, ES8311_CLK_MANAGER_REG06, regv);
     } else {
-        regv = es8311_read_reg(ES8311_CLK_MANAGER_REG06);
+        regv = es8311_seq_read(&seq, ES8311_CLK_MANAGER_REG06);
         regv &= ~(0x20);
-        ret |= es8311_write_reg(ES8311_CLK_MANAGER_REG06, regv);
+        ret |= es8311_seq_write(&seq, ES8311_CLK_MANAGER_REG06, regv);
     }
 
-    ret |= es8311_write_reg(ES8311_SYSTEM_REG14, 0x1A);
+    ret |= es8311_seq_write(&seq, ES8311_SYSTEM_REG14, 0x1A);
 
     /*
      *   pdm dmic enable or disable
      */
     if (IS_DMIC) {
-        regv = es8311_read_reg(ES8311_SYSTEM_REG14);
+        regv = es8311_seq_read(&seq, ES8311_SYSTEM_REG14);
         regv |= 0x40;
-        ret |= es8311_write_reg(ES8311_SYSTEM_REG14, regv);
+        ret |= es8311_seq_write(&seq, ES8311_SYSTEM_REG14, regv);
     } else {
-        regv = es8311_read_reg(ES8311_SYSTEM_REG14);
+        regv = es8311_seq_read(&seq, ES8311_SYSTEM_REG14);
         regv &= ~(0x40);
-        ret |= es8311_write_reg(ES8311_SYSTEM_REG14, regv);
-    }
-
-    ret |= es8311_write_reg(ES8311_SYSTEM_REG12, 0x00);
-    ret |= es8311_write_reg(ES8311_SYSTEM_REG13, 0x10);
-    // es8311_write_reg(ES8311_SDPIN_REG09, 0x00);
-    // es8311_write_reg(ES8311_SDPOUT_REG0A, 0x00);
-    ret |= es8311_write_reg(ES8311_SYSTEM_REG0E, 0x02);
-    ret |= es8311_write_reg(ES8311_ADC_REG15, 0x40);
-    ret |= es8311_write_reg(ES8311_ADC_REG1B, 0x0A);
-    ret |= es8311_write_reg(ES8311_ADC_REG1C, 0x6A);
-    ret |= es8311_write_reg(ES8311_DAC_REG37, 0x48);
-    ret |= es8311_write_reg(ES8311_GPIO_REG44, 0x08);
-    //ret |= es8311_write_reg(ES8311_GPIO_REG44, 0x78);
-    ret |= es8311_write_reg(ES8311_ADC_REG17, 0xBF);
-    ret |= es8311_write_reg(ES8311_DAC_REG32, 0xBF);
+        ret |= es8311_seq_write(&seq, ES8311_SYSTEM_REG14, regv);
+    }
+
+    ret |= es8311_seq_flush(&seq);
+    ret |= es8311_write_regs(es8311_start_seq, sizeof(es8311_start_seq) / sizeof(es8311_start_seq[0]));
 
     //gpio_matrix_out(IIS_MCLK, CLK_I2S_MUX_IDX, 0, 0);
     es8311_pa_power(true);
     return ESP_OK;
 }
 
+esp_err_t es8311_set_sample_rate(int sample_fre, es8311_reclock_cb_t reclock, void *arg)
+{
+    es8311_seq_t seq = { .count = 0 };
+    int mclk_fre = sample_fre * MCLK_DIV_FRE;
+    int coeff = get_coeff(mclk_fre, sample_fre);
+    int ret = ESP_OK;
+
+    if (coeff < 0) {
+        ESP_LOGE(TAG, "Unable to configure sample rate %dHz with %dHz MCLK\n", sample_fre, mclk_fre);
+        return ESP_FAIL;
+    }
+
+    if (sample_fre == current_rate) {
+        return reclock != NULL ? reclock(sample_fre, arg) : ESP_OK;
+    }
+
+    int regv = es8311_read_reg(ES8311_DAC_REG31);
+    if (regv < 0) {
+        return ESP_FAIL;
+    }
+
+    /*!< muted for the whole switch, not just for the divider writes */
+    ret |= es8311_write_reg(ES8311_DAC_REG31, regv | 0x60);
+    if (reclock != NULL && reclock(sample_fre, arg) != ESP_OK) {
+        /*!< I2S still runs at the old rate, keep the codec there too */
+        ESP_LOGE(TAG, "I2S reclock to %dHz failed", sample_fre);
+        es8311_write_reg(ES8311_DAC_REG31, regv);
+        return ESP_FAIL;
+    }
+
+    ret |= es8311_seq_clock(&seq, coeff);
+    ret |= es8311_seq_write(&seq, ES8311_DAC_REG31, regv);
+    ret |= es8311_seq_flush(&seq);
+
+    if (ret == ESP_OK) {
+        current_rate = sample_fre;
+    }
+
+    ESP_LOGI(TAG, "sample rate %dHz", sample_fre);
+    return ret ? ESP_FAIL : ESP_OK;
+}
+
+esp_err_t es8311_standby(bool enable)
+{
+    i2c_bus_reg_t regs[ES8311_STANDBY_REGS];
+    int ret = ESP_OK;
+
+    if (enable == in_standby) {
+        return ESP_OK;
+    }
+
+    if (enable) {
+        for (int i = 0; i < ES8311_STANDBY_REGS; i++) {
+            int regv = es8311_read_reg(es8311_standby_seq[i].reg);
+            if (regv < 0) {
+                return ESP_FAIL;
+            }
+            standby_saved[i] = regv;
+            regs[i].reg = es8311_standby_seq[i].reg;
+            regs[i].data = es8311_standby_seq[i].reg == ES8311_DAC_REG31 ? regv | es8311_standby_seq[i].data
+                                                                        : es8311_standby_seq[i].data;
+        }
+
+        es8311_pa_power(false);
+        ret = es8311_write_regs(regs, ES8311_STANDBY_REGS);
+    } else {
+        for (int i = 0; i < ES8311_STANDBY_REGS; i++) {
+            regs[i].reg = es8311_standby_seq[ES8311_STANDBY_REGS - 1 - i].reg;
+            regs[i].data = standby_saved[ES8311_STANDBY_REGS - 1 - i];
+        }
+
+        ret = es8311_write_regs(regs, ES8311_STANDBY_REGS);
+        /*!< retry anything left dirty while asleep, e.g. a failed async volume write */
+        ret |= es8311_cache_sync(false);
+        es8311_pa_power(true);
+    }
+
+    in_standby = enable;
+    ESP_LOGI(TAG, "%s standby", enable ? "enter" : "leave");
+    return ret ? ESP_FAIL : ESP_OK;
+}
+
 esp_err_t es8311_deinit(void)
 {
     es8311_pa_power(false);
@@ -494,6 +868,47 @@ esp_err_t es8311_set_voice_volume(int volume)
     return res;
 }
 
+/*!< arg is (reg << 8) | data of the write that completed */
+static void es8311_async_done(esp_err_t err, void *arg)
+{
+    uint8_t reg_addr = (uint8_t)((uintptr_t)arg >> 8);
+    uint8_t data = (uint8_t)(uintptr_t)arg;
+
+    portENTER_CRITICAL(&cache_lock);
+    if (err != ESP_OK) {
+        CACHE_SET(reg_dirty, reg_addr);
+    } else if (reg_cache[reg_addr] == data) {
+        /*!< a newer value may have been cached since, its own write settles it */
+        CACHE_CLR(reg_dirty, reg_addr);
+    }
+    portEXIT_CRITICAL(&cache_lock);
+}
+
+esp_err_t es8311_set_voice_volume_async(int volume)
+{
+    if (volume < 0) {
+        volume = 0;
+    } else if (volume > 100) {
+        volume = 100;
+    }
+
+    i2c_bus_reg_t reg = {
+        .reg = ES8311_DAC_REG32,
+        .data = (volume) * 2550 / 1000 + 0.5,
+    };
+
+    if (!es8311_cache_update(reg.reg, reg.data)) {
+        return ESP_OK;
+    }
+
+    esp_err_t ret = i2c_bus_write_regs_async(ES8311_ADDR, &reg, 1, es8311_async_done,
+                                             (void *)(uintptr_t)((reg.reg << 8) | reg.data));
+    if (ret != ESP_OK) {
+        es8311_cache_mark(&reg, 1, false);
+    }
+    return ret;
+}
+
 esp_err_t es8311_get_voice_volume(int *volume)
 {
     int res = ESP_OK;
@@ -523,7 +938,7 @@ int es8311_get_voice_mute(int *mute)
 {
     int res = -1;
     uint8_t reg = 0;
-    res = es8311_read_reg(ES8311_DAC_REG31);
+    res = es8311_read_awake(ES8311_DAC_REG31);
 
     if (res != ESP_FAIL) {
         reg = (res & 0x20) >> 5;
@@ -542,8 +957,8 @@ int es8311_set_mic_gain(es8311_mic_gain_t gain_db)
 
 void es8311_read_all(void)
 {
-    for (int i = 0; i < 0x4A; i++) {
-        uint8_t reg = es8311_read_reg(i);
-        ets_printf("REG:%02x, %02x\n", reg, i);
+    for (int i = 0; i < ES8311_CACHE_REGS; i++) {
+        int reg = es8311_read_reg(i);
+        ets_printf("REG:%02x, %02x%s\n", reg, i, CACHE_TEST(reg_dirty, i) ? " (dirty)" : "");
     }
 }
@@ -133,6 +133,38 @@ typedef enum {
  */
 esp_err_t es8311_init(int sample_fre);
 
+/**
+ * @brief Called by es8311_set_sample_rate() while the DAC is muted, to move
+ *        the I2S peripheral to the new rate (typically i2s_set_clk()).
+ */
+typedef esp_err_t (*es8311_reclock_cb_t)(int sample_fre, void *arg);
+
+/**
+ * @brief Switch the codec to another sample rate without a full init.
+ *        The DAC is muted, `reclock` switches the bus clock, then only the
+ *        clock manager registers that differ are rewritten before unmuting,
+ *        so the codec never plays with dividers that don't match the bus.
+ *
+ * @param sample_fre sample rate, any rate of the coefficient table for MCLK = 32 * fs
+ * @param reclock    moves the I2S clock to sample_fre, may be NULL
+ * @param arg        passed to reclock
+ *
+ * @return - ESP_FAIL unsupported rate, bus error or reclock failure
+ *         - ESP_OK  codec clocked for sample_fre
+ */
+esp_err_t es8311_set_sample_rate(int sample_fre, es8311_reclock_cb_t reclock, void *arg);
+
+/**
+ * @brief Put the codec into standby (DAC muted, analog blocks powered down,
+ *        PA off) or bring it back to the state it had before.
+ *
+ * @param enable true to enter standby, false to wake
+ *
+ * @return - ESP_FAIL bus error
+ *         - ESP_OK  success, or already in the requested state
+ */
+esp_err_t es8311_standby(bool enable);
+
 /**
  * @brief Delete es8311
  *           
@@ -151,6 +183,18 @@ esp_err_t es8311_deinit(void);
  */
 esp_err_t es8311_set_voice_volume(int volume);
 
+/**
+ * @brief Set the volume without waiting for the I2C transaction, it is
+ *        queued for the i2c_bus task and applied in submission order.
+ *
+ * @param volume set volume (0 ~ 100)
+ *
+ * @return - ESP_OK queued
+ *         - ESP_ERR_TIMEOUT the bus queue is full, volume unchanged
+ *         - ESP_ERR_INVALID_STATE the i2c_bus task isn't running, volume unchanged
+ */
+esp_err_t es8311_set_voice_volume_async(int volume);
+
 /**
  * @brief Get the volume
  *
@@ -161,6 +205,17 @@ esp_err_t es8311_set_voice_volume(int volume);
  */
 esp_err_t es8311_get_voice_volume(int *volume);
 
+/**
+ * @brief Push the driver's shadow registers to the codec
+ *
+ * @param all true to rewrite every known register, e.g. after the codec
+ *            lost power; false to only retry writes that failed
+ *
+ * @return - ESP_FAIL a bus write failed, the registers stay dirty
+ *         - ESP_OK  codec matches the shadow
+ */
+esp_err_t es8311_cache_sync(bool all);
+
 /**
  * @brief read all reg about es8311
  */
@@ -13,51 +13,142 @@
 // limitations under the License.
 
 #include <stdio.h>
+#include <string.h>
 #include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
 #include "driver/i2c.h"
 #include "i2c_bus.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
 #include "freertos/semphr.h"
 #include "board.h"
 
+static const char *TAG = "I2C_BUS";
+
 SemaphoreHandle_t i2c_bus_mux = NULL;
 
+/*!< Even the longest batch is a few ms at 100 kHz, don't hang a second on a stuck bus */
+#define I2C_BUS_TIMEOUT_MS 100
+
+#define I2C_BUS_MAX_DEVICES 4
+#define I2C_BUS_QUEUE_LEN 8
+#define I2C_BUS_TASK_STACK 2048
+#define I2C_BUS_TASK_PRIO 6
+
+typedef struct {
+    uint8_t slave_addr;
+    uint8_t count;
+    i2c_bus_reg_t regs[I2C_BUS_ASYNC_MAX_REGS];
+    i2c_bus_done_cb_t cb;
+    void *arg;
+    int64_t submit_us;
+} i2c_bus_txn_t;
+
+static struct {
+    uint8_t slave_addr;
+    uint32_t clk_hz;
+} device_speed[I2C_BUS_MAX_DEVICES];
+static int device_count = 0;
+
+static i2c_config_t conf;
+static QueueHandle_t txn_queue = NULL;
+static i2c_bus_stats_t stats;
+
+/*!< Called with i2c_bus_mux held */
+static esp_err_t i2c_bus_apply_speed(uint8_t slave_addr)
+{
+    uint32_t clk_hz = I2C_BUS_DEFAULT_CLK_HZ;
+
+    for (int i = 0; i < device_count; i++) {
+        if (device_speed[i].slave_addr == slave_addr) {
+            clk_hz = device_speed[i].clk_hz;
+            break;
+        }
+    }
+
+    if (conf.master.clk_speed == clk_hz) {
+        return ESP_OK;
+    }
+
+    conf.master.clk_speed = clk_hz;
+    return i2c_param_config(I2C_NUM_0, &conf);
+}
+
+/*!< Run a prepared command link for `slave_addr`, timing the bus part */
+static esp_err_t i2c_bus_run(uint8_t slave_addr, i2c_cmd_handle_t cmd)
+{
+    esp_err_t res;
+
+    xSemaphoreTake(i2c_bus_mux, portMAX_DELAY);
+    int64_t start = esp_timer_get_time();
+    res = i2c_bus_apply_speed(slave_addr);
+    res |= i2c_master_cmd_begin(0, cmd, I2C_BUS_TIMEOUT_MS / portTICK_RATE_MS);
+    uint32_t elapsed = esp_timer_get_time() - start;
+
+    stats.count++;
+    stats.errors += res ? 1 : 0;
+    stats.last_us = elapsed;
+    stats.total_us += elapsed;
+    if (elapsed > stats.max_us) {
+        stats.max_us = elapsed;
+    }
+    xSemaphoreGive(i2c_bus_mux);
+
+    return res;
+}
+
 esp_err_t i2c_bus_write_reg(uint8_t slave_addr, uint8_t reg_addr, uint8_t data)
+{
+    i2c_bus_reg_t reg = { .reg = reg_addr, .data = data };
+    return i2c_bus_write_regs(slave_addr, &reg, 1);
+}
+
+esp_err_t i2c_bus_write_regs(uint8_t slave_addr, const i2c_bus_reg_t *regs, size_t count)
 {
     int res = 0;
-    xSemaphoreTake(i2c_bus_mux, portMAX_DELAY);
+
+    if (count == 0) {
+        return ESP_OK;
+    }
+
     i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    res |= i2c_master_start(cmd);
-    res |= i2c_master_write_byte(cmd, slave_addr<<1, 1 /*ACK_CHECK_EN*/);
-    res |= i2c_master_write_byte(cmd, reg_addr, 1 /*ACK_CHECK_EN*/);
-    res |= i2c_master_write_byte(cmd, data, 1 /*ACK_CHECK_EN*/);
+    for (size_t i = 0; i < count; i++) {
+        res |= i2c_master_start(cmd);
+        res |= i2c_master_write_byte(cmd, slave_addr<<1, 1 /*ACK_CHECK_EN*/);
+        res |= i2c_master_write_byte(cmd, regs[i].reg, 1 /*ACK_CHECK_EN*/);
+        res |= i2c_master_write_byte(cmd, regs[i].data, 1 /*ACK_CHECK_EN*/);
+    }
     res |= i2c_master_stop(cmd);
-    res |= i2c_master_cmd_begin(0, cmd, 1000 / portTICK_RATE_MS);
+    res |= i2c_bus_run(slave_addr, cmd);
     i2c_cmd_link_delete(cmd);
-    xSemaphoreGive(i2c_bus_mux);
     return res ? ESP_FAIL: ESP_OK;
 }
 
 esp_err_t i2c_bus_read_reg(uint8_t slave_addr, uint8_t reg_addr, uint8_t *pdata)
+{
+    return i2c_bus_read_regs(slave_addr, reg_addr, pdata, 1);
+}
+
+esp_err_t i2c_bus_read_regs(uint8_t slave_addr, uint8_t reg_addr, uint8_t *pdata, size_t size)
 {
     int res = 0;
-    xSemaphoreTake(i2c_bus_mux, portMAX_DELAY);
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
 
+    if (size == 0) {
+        return ESP_OK;
+    }
+
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
     res |= i2c_master_start(cmd);
     res |= i2c_master_write_byte(cmd, slave_addr<<1, 1 /*ACK_CHECK_EN*/);
     res |= i2c_master_write_byte(cmd, reg_addr, 1 /*ACK_CHECK_EN*/);
-    res |= i2c_master_stop(cmd);
-    res |= i2c_master_cmd_begin(0, cmd, 1000 / portTICK_RATE_MS);
-    i2c_cmd_link_delete(cmd);
-
-    cmd = i2c_cmd_link_create();
     res |= i2c_master_start(cmd);
     res |= i2c_master_write_byte(cmd, (slave_addr<<1) | 0x01, 1 /*ACK_CHECK_EN*/);
-    res |= i2c_master_read_byte(cmd, pdata, 0x01/*NACK_VAL*/);
+    res |= i2c_master_read(cmd, pdata, size, I2C_MASTER_LAST_NACK);
     res |= i2c_master_stop(cmd);
-    res |= i2c_master_cmd_begin(0, cmd, 1000 / portTICK_RATE_MS);
+    res |= i2c_bus_run(slave_addr, cmd);
     i2c_cmd_link_delete(cmd);
-    xSemaphoreGive(i2c_bus_mux);
     return res ? ESP_FAIL: ESP_OK;
 }
 
@@ -65,7 +156,6 @@ esp_err_t i2c_bus_read_data(uint8_t slave_addr, uint8_t *pdata, int size)
 {
     int x;
     int res = 0;
-    xSemaphoreTake(i2c_bus_mux, portMAX_DELAY);
     i2c_cmd_handle_t cmd = i2c_cmd_link_create();
     res |= i2c_master_start(cmd);
     res |= i2c_master_write_byte(cmd, (slave_addr<<1) | 0x01, 1 /*ACK_CHECK_EN*/);
@@ -74,27 +164,131 @@ esp_err_t i2c_bus_read_data(uint8_t slave_addr, uint8_t *pdata, int size)
     }
     res |= i2c_master_read_byte(cmd, &pdata[x], 0x01/*NACK_VAL*/);
     res |= i2c_master_stop(cmd);
-    res |= i2c_master_cmd_begin(0, cmd, 1000 / portTICK_RATE_MS);
+    res |= i2c_bus_run(slave_addr, cmd);
     i2c_cmd_link_delete(cmd);
-    xSemaphoreGive(i2c_bus_mux);
     return res ? ESP_FAIL: ESP_OK;
 }
 
+esp_err_t i2c_bus_set_device_speed(uint8_t slave_addr, uint32_t clk_hz)
+{
+    esp_err_t res = ESP_OK;
+
+    xSemaphoreTake(i2c_bus_mux, portMAX_DELAY);
+    int i;
+    for (i = 0; i < device_count; i++) {
+        if (device_speed[i].slave_addr == slave_addr) {
+            break;
+        }
+    }
+
+    if (i == I2C_BUS_MAX_DEVICES) {
+        res = ESP_ERR_NO_MEM;
+    } else {
+        device_speed[i].slave_addr = slave_addr;
+        device_speed[i].clk_hz = clk_hz;
+        if (i == device_count) {
+            device_count++;
+        }
+    }
+    xSemaphoreGive(i2c_bus_mux);
+
+    return res;
+}
+
+esp_err_t i2c_bus_write_regs_async(uint8_t slave_addr, const i2c_bus_reg_t *regs, size_t count,
+                                   i2c_bus_done_cb_t cb, void *arg)
+{
+    if (txn_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (count == 0 || count > I2C_BUS_ASYNC_MAX_REGS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    i2c_bus_txn_t txn = {
+        .slave_addr = slave_addr,
+        .count = count,
+        .cb = cb,
+        .arg = arg,
+        .submit_us = esp_timer_get_time(),
+    };
+    memcpy(txn.regs, regs, count * sizeof(i2c_bus_reg_t));
+
+    if (xQueueSend(txn_queue, &txn, 0) != pdTRUE) {
+        xSemaphoreTake(i2c_bus_mux, portMAX_DELAY);
+        stats.dropped++;
+        xSemaphoreGive(i2c_bus_mux);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    return ESP_OK;
+}
+
+static void i2c_bus_task(void *arg)
+{
+    i2c_bus_txn_t txn;
+
+    while (1) {
+        if (xQueueReceive(txn_queue, &txn, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        uint32_t waited = esp_timer_get_time() - txn.submit_us;
+        esp_err_t res = i2c_bus_write_regs(txn.slave_addr, txn.regs, txn.count);
+
+        xSemaphoreTake(i2c_bus_mux, portMAX_DELAY);
+        if (waited > stats.queue_max_us) {
+            stats.queue_max_us = waited;
+        }
+        xSemaphoreGive(i2c_bus_mux);
+
+        if (res != ESP_OK) {
+            ESP_LOGW(TAG, "async write to 0x%02x failed", txn.slave_addr);
+        }
+
+        if (txn.cb) {
+            txn.cb(res, txn.arg);
+        }
+    }
+}
+
+void i2c_bus_get_stats(i2c_bus_stats_t *out)
+{
+    xSemaphoreTake(i2c_bus_mux, portMAX_DELAY);
+    *out = stats;
+    xSemaphoreGive(i2c_bus_mux);
+}
+
+void i2c_bus_reset_stats(void)
+{
+    xSemaphoreTake(i2c_bus_mux, portMAX_DELAY);
+    memset(&stats, 0, sizeof(stats));
+    xSemaphoreGive(i2c_bus_mux);
+}
+
 esp_err_t i2c_bus_init(void)
 {
     int res;
     int i2c_master_port = I2C_NUM_0;
-    static i2c_config_t conf;
     conf.mode = I2C_MODE_MASTER;
     conf.sda_io_num = I2C_SDA;         
     conf.sda_pullup_en = 1;
     conf.scl_io_num = I2C_SCL;
     conf.scl_pullup_en = 1;
-    conf.master.clk_speed = 100000;
+    conf.master.clk_speed = I2C_BUS_DEFAULT_CLK_HZ;
     res = i2c_driver_install(i2c_master_port, conf.mode, 0, 0, 0);
     res |= i2c_param_config(i2c_master_port, &conf);
     
 
     i2c_bus_mux = xSemaphoreCreateMutex();
+    txn_queue = xQueueCreate(I2C_BUS_QUEUE_LEN, sizeof(i2c_bus_txn_t));
+    if (i2c_bus_mux == NULL || txn_queue == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(i2c_bus_task, "i2c_bus_task", I2C_BUS_TASK_STACK, NULL, I2C_BUS_TASK_PRIO, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
     return res ? ESP_FAIL: ESP_OK;
 }
@@ -15,18 +15,82 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include "esp_err.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#define I2C_BUS_DEFAULT_CLK_HZ  100000
+#define I2C_BUS_FAST_CLK_HZ     400000
+
+/*!< Largest burst an async write can carry, longer ones must use i2c_bus_write_regs */
+#define I2C_BUS_ASYNC_MAX_REGS  8
+
+typedef struct {
+    uint8_t reg;
+    uint8_t data;
+} i2c_bus_reg_t;
+
+/*
+ * Called from the bus task once an async transaction is done. Keep it short,
+ * the next queued transaction waits for it.
+ */
+typedef void (*i2c_bus_done_cb_t)(esp_err_t err, void *arg);
+
+typedef struct {
+    uint32_t count;        /*!< transactions run on the bus */
+    uint32_t errors;       /*!< of which failed */
+    uint32_t last_us;      /*!< bus time of the last transaction */
+    uint32_t max_us;       /*!< worst bus time */
+    uint64_t total_us;     /*!< summed bus time, total_us / count is the mean */
+    uint32_t queue_max_us; /*!< worst wait between async submit and start */
+    uint32_t dropped;      /*!< async submits refused because the queue was full */
+} i2c_bus_stats_t;
+
 esp_err_t i2c_bus_write_reg(uint8_t slave_addr, uint8_t reg_addr, uint8_t data);
 
+/*
+ * Write `count` register/value pairs in order, in a single locked command
+ * link (repeated START between pairs, one STOP at the end).
+ */
+esp_err_t i2c_bus_write_regs(uint8_t slave_addr, const i2c_bus_reg_t *regs, size_t count);
+
+/*
+ * Read `size` consecutive registers starting at `reg_addr`, relying on the
+ * device's register address auto-increment.
+ */
+esp_err_t i2c_bus_read_regs(uint8_t slave_addr, uint8_t reg_addr, uint8_t *pdata, size_t size);
+
 esp_err_t i2c_bus_read_reg(uint8_t slave_addr, uint8_t reg_addr, uint8_t *pdata);
 
 esp_err_t i2c_bus_read_data(uint8_t slave_addr, uint8_t *pdata, int size);
 
+/*
+ * Clock the bus at `clk_hz` whenever `slave_addr` is addressed, e.g.
+ * I2C_BUS_FAST_CLK_HZ for devices rated for fast mode. Other devices keep
+ * I2C_BUS_DEFAULT_CLK_HZ.
+ */
+esp_err_t i2c_bus_set_device_speed(uint8_t slave_addr, uint32_t clk_hz);
+
+/*
+ * Queue a burst write for the bus task and return right away. Async writes
+ * run in submission order; they are not ordered against the blocking calls
+ * above. `cb` may be NULL.
+ *
+ * @return - ESP_OK queued
+ *         - ESP_ERR_INVALID_ARG count is 0 or above I2C_BUS_ASYNC_MAX_REGS
+ *         - ESP_ERR_INVALID_STATE the bus task isn't running, i2c_bus_init() failed or wasn't called
+ *         - ESP_ERR_TIMEOUT the queue is full, nothing was sent
+ */
+esp_err_t i2c_bus_write_regs_async(uint8_t slave_addr, const i2c_bus_reg_t *regs, size_t count,
+                                   i2c_bus_done_cb_t cb, void *arg);
+
+void i2c_bus_get_stats(i2c_bus_stats_t *stats);
+
+void i2c_bus_reset_stats(void);
+
 esp_err_t i2c_bus_init(void);
 
 #ifdef __cplusplus
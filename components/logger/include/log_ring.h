@@ -0,0 +1,37 @@
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "logger.h"
+
+// Number of slots in the ring, must be a power of two and >= BUFFER_SIZE
+#define LOG_RING_SLOTS 32
+#define LOG_RING_MASK (LOG_RING_SLOTS - 1)
+
+/*
+ * Each slot carries a stamp: ((seq + 1) << 1) once entry `seq` is committed,
+ * with the low bit set while a writer is filling it in. 0 means never written.
+ */
+typedef struct
+{
+    atomic_uint stamp;
+    buffer_entry_t entry;
+} log_ring_slot_t;
+
+typedef struct
+{
+    atomic_uint head; // next sequence number to hand out to a writer
+    atomic_uint tail; // oldest sequence number not yet consumed
+    log_ring_slot_t slots[LOG_RING_SLOTS];
+} log_ring_t;
+
+void log_ring_reset(log_ring_t *ring);
+void log_ring_push(log_ring_t *ring, const buffer_entry_t *entry);
+size_t log_ring_snapshot(log_ring_t *ring, buffer_entry_t *out, size_t max);
+uint8_t log_ring_last(log_ring_t *ring, buffer_entry_t *entry);
+uint8_t log_ring_pop(log_ring_t *ring, buffer_entry_t *entry);
+size_t log_ring_read_from(log_ring_t *ring, uint32_t *cursor, buffer_entry_t *out, size_t max);
+
+#endif // LOG_RING_H
@@ -2,6 +2,10 @@
 #define LOGGER_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
 
 #define BUFFER_SIZE 20
 
@@ -12,7 +16,10 @@ typedef enum
     PREVIOUS = 2,
     STOP = 3,
     VOLUME_UP= 4,
-    VOLUME_DOWN= 5
+    VOLUME_DOWN= 5,
+    VOLUME_SET = 6,
+    TRACK_SELECT = 7,
+    SEEK = 8
 } EventType;
 
 
@@ -38,8 +45,10 @@ void buffer_print();
 void buffer_write(EventType event, uint8_t song_id);
 void buffer_init(void);
 void init_logger(void);
-circular_buffer_t get_buffer_from_nvs(void);
 void ntp_sync_time(void);
 uint8_t get_last_entry(buffer_entry_t *entry);
+uint32_t buffer_cursor(void);
+size_t buffer_read_since(uint32_t *cursor, buffer_entry_t *entries, size_t max);
+esp_err_t logger_subscribe(TaskHandle_t task);
 
 #endif // LOGGER_H
@@ -0,0 +1,187 @@
+#include "log_ring.h"
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+// Only reached when a writer laps another one still filling the same slot
+#define LOG_RING_YIELD() vTaskDelay(1)
+#else
+#include <sched.h>
+#define LOG_RING_YIELD() sched_yield()
+#endif
+
+#define STAMP_BUSY 1u
+#define STAMP_FOR(seq) (((unsigned int)(seq) + 1u) << 1)
+
+enum
+{
+    SLOT_OK = 0,
+    SLOT_NOT_READY,
+    SLOT_OVERWRITTEN
+};
+
+static int read_slot(log_ring_t *ring, unsigned int seq, buffer_entry_t *out)
+{
+    log_ring_slot_t *slot = &ring->slots[seq & LOG_RING_MASK];
+    unsigned int want = STAMP_FOR(seq);
+
+    unsigned int before = atomic_load_explicit(&slot->stamp, memory_order_acquire);
+    if (before != want)
+    {
+        // A newer (even or busy) stamp means this entry has been lapped
+        return (int)((before & ~STAMP_BUSY) - want) > 0 ? SLOT_OVERWRITTEN : SLOT_NOT_READY;
+    }
+
+    buffer_entry_t copy;
+    memcpy(&copy, &slot->entry, sizeof(copy));
+    atomic_thread_fence(memory_order_acquire);
+
+    if (atomic_load_explicit(&slot->stamp, memory_order_relaxed) != before)
+    {
+        return SLOT_OVERWRITTEN;
+    }
+
+    *out = copy;
+    return SLOT_OK;
+}
+
+// First sequence number worth looking at: the consumer position, but never
+// further back than the last BUFFER_SIZE entries handed out.
+static unsigned int window_start(log_ring_t *ring, unsigned int head)
+{
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail > BUFFER_SIZE)
+    {
+        return head - BUFFER_SIZE;
+    }
+    return tail;
+}
+
+void log_ring_reset(log_ring_t *ring)
+{
+    atomic_store(&ring->head, 0);
+    atomic_store(&ring->tail, 0);
+    for (int i = 0; i < LOG_RING_SLOTS; i++)
+    {
+        atomic_store(&ring->slots[i].stamp, 0);
+        memset(&ring->slots[i].entry, 0, sizeof(buffer_entry_t));
+    }
+}
+
+void log_ring_push(log_ring_t *ring, const buffer_entry_t *entry)
+{
+    unsigned int seq = atomic_fetch_add_explicit(&ring->head, 1, memory_order_relaxed);
+    log_ring_slot_t *slot = &ring->slots[seq & LOG_RING_MASK];
+    unsigned int mine = STAMP_FOR(seq);
+
+    unsigned int current = atomic_load_explicit(&slot->stamp, memory_order_relaxed);
+    while (1)
+    {
+        if (current & STAMP_BUSY)
+        {
+            LOG_RING_YIELD();
+            current = atomic_load_explicit(&slot->stamp, memory_order_relaxed);
+            continue;
+        }
+
+        if (current != 0 && (int)(current - mine) > 0)
+        {
+            // A writer one lap ahead already owns the slot, this entry is stale
+            return;
+        }
+
+        if (atomic_compare_exchange_weak_explicit(&slot->stamp, &current, mine | STAMP_BUSY,
+                                                  memory_order_acquire, memory_order_relaxed))
+        {
+            break;
+        }
+    }
+
+    atomic_thread_fence(memory_order_release);
+    memcpy(&slot->entry, entry, sizeof(buffer_entry_t));
+    atomic_store_explicit(&slot->stamp, mine, memory_order_release);
+}
+
+size_t log_ring_snapshot(log_ring_t *ring, buffer_entry_t *out, size_t max)
+{
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t count = 0;
+
+    for (unsigned int seq = window_start(ring, head); seq != head && count < max; seq++)
+    {
+        if (read_slot(ring, seq, &out[count]) == SLOT_OK)
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+uint8_t log_ring_last(log_ring_t *ring, buffer_entry_t *entry)
+{
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    unsigned int start = window_start(ring, head);
+
+    for (unsigned int seq = head; seq != start; seq--)
+    {
+        if (read_slot(ring, seq - 1, entry) == SLOT_OK)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+uint8_t log_ring_pop(log_ring_t *ring, buffer_entry_t *entry)
+{
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    for (unsigned int seq = window_start(ring, head); seq != head; seq++)
+    {
+        int res = read_slot(ring, seq, entry);
+        if (res == SLOT_OK)
+        {
+            atomic_store_explicit(&ring->tail, seq + 1, memory_order_release);
+            return 1;
+        }
+        if (res == SLOT_NOT_READY)
+        {
+            // Keep ordering: don't hand out entries past one still being written
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+size_t log_ring_read_from(log_ring_t *ring, uint32_t *cursor, buffer_entry_t *out, size_t max)
+{
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    unsigned int seq = *cursor;
+    size_t count = 0;
+
+    if (head - seq > BUFFER_SIZE)
+    {
+        // The reader fell behind, skip to the oldest entry still meaningful
+        seq = head - BUFFER_SIZE;
+    }
+
+    for (; seq != head && count < max; seq++)
+    {
+        int res = read_slot(ring, seq, &out[count]);
+        if (res == SLOT_NOT_READY)
+        {
+            break;
+        }
+        if (res == SLOT_OK)
+        {
+            count++;
+        }
+    }
+
+    *cursor = seq;
+    return count;
+}
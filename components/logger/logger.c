@@ -4,17 +4,26 @@
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "esp_sntp.h"
 #include <string.h>
 #include <time.h>
+#include <stdatomic.h>
 #include "audio.h"
+#include "log_ring.h"
 
 #define TAG "logger"
 #define NVS_NAMESPACE "storage"
 
-circular_buffer_t buffer;
-SemaphoreHandle_t buffer_semaphore;
+// Writers only touch the ring; the flush task persists it to NVS afterwards
+static log_ring_t ring;
+static TaskHandle_t flush_task_handle = NULL;
+
+#define LOGGER_MAX_SUBSCRIBERS 4
+
+static TaskHandle_t subscribers[LOGGER_MAX_SUBSCRIBERS];
+static atomic_int subscriber_count;
+static portMUX_TYPE subscribers_lock = portMUX_INITIALIZER_UNLOCKED;
 
 void ntp_sync_time(void)
 {
@@ -38,22 +47,23 @@ void ntp_sync_time(void)
 
 char *buffer_to_json()
 {
-    xSemaphoreTake(buffer_semaphore, portMAX_DELAY);
+    buffer_entry_t entries[BUFFER_SIZE];
+    size_t count = log_ring_snapshot(&ring, entries, BUFFER_SIZE);
 
     cJSON *root = cJSON_CreateObject();
     cJSON *buffer_array = cJSON_CreateArray();
 
-    for (int i = 0; i < buffer.count; i++)
+    for (int i = 0; i < count; i++)
     {
-        int index = (buffer.tail + i) % BUFFER_SIZE;
         cJSON *entry = cJSON_CreateObject();
-        cJSON_AddItemToObject(entry, "event", cJSON_CreateString(getEventName(buffer.data[index].event)));
-        cJSON_AddItemToObject(entry, "song_id", cJSON_CreateNumber(buffer.data[index].song_id));
+        cJSON_AddItemToObject(entry, "event", cJSON_CreateString(getEventName(entries[i].event)));
+        cJSON_AddItemToObject(entry, "song_id", cJSON_CreateNumber(entries[i].song_id));
 
-        if (buffer.data[index].timestamp != 0)
+        if (entries[i].timestamp != 0)
         {
             char timestamp_str[20];
-            struct tm *timeinfo = localtime((time_t *)&buffer.data[index].timestamp);
+            time_t timestamp = entries[i].timestamp;
+            struct tm *timeinfo = localtime(&timestamp);
             strftime(timestamp_str, sizeof(timestamp_str), "%m/%d/%Y %H:%M:%S", timeinfo);
             cJSON_AddItemToObject(entry, "timestamp", cJSON_CreateString(timestamp_str));
         }
@@ -69,7 +79,6 @@ char *buffer_to_json()
     char *json_string = cJSON_Print(root);
     cJSON_Delete(root);
 
-    xSemaphoreGive(buffer_semaphore);
     return json_string;
 }
 
@@ -103,35 +112,26 @@ void erase_namespace()
     ESP_LOGI(TAG, "Namespace '%s' erased.", NVS_NAMESPACE);
 }
 
-uint8_t buffer_read(buffer_entry_t *entry)
+static void buffer_persist(void)
 {
-    xSemaphoreTake(buffer_semaphore, portMAX_DELAY);
-
     nvs_handle_t logger;
     esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &logger);
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
-        xSemaphoreGive(buffer_semaphore);
-        return 0;
-    }
-
-    if (buffer.count == 0)
-    {
-        ESP_LOGI(TAG, "Buffer is empty");
-        nvs_close(logger);
-        xSemaphoreGive(buffer_semaphore);
-        return 0;
+        return;
     }
 
-    *entry = buffer.data[buffer.tail];
-    buffer.tail = (buffer.tail + 1) % BUFFER_SIZE;
-    buffer.count--;
+    circular_buffer_t snapshot;
+    memset(&snapshot, 0, sizeof(circular_buffer_t));
+    snapshot.count = log_ring_snapshot(&ring, snapshot.data, BUFFER_SIZE);
+    snapshot.head = snapshot.count % BUFFER_SIZE;
+    snapshot.tail = 0;
 
-    err = nvs_set_blob(logger, "buffer", &buffer, sizeof(circular_buffer_t));
+    err = nvs_set_blob(logger, "buffer", &snapshot, sizeof(circular_buffer_t));
     if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "Error (%s) updating buffer in NVS", esp_err_to_name(err));
+        ESP_LOGE(TAG, "Error (%s) writing buffer to NVS", esp_err_to_name(err));
     }
     else
     {
@@ -139,121 +139,125 @@ uint8_t buffer_read(buffer_entry_t *entry)
     }
 
     nvs_close(logger);
-    ESP_LOGI(TAG, "Read event: %s, song ID: %d", getEventName(entry->event), entry->song_id);
-
-    xSemaphoreGive(buffer_semaphore);
-    return 1;
 }
 
-void buffer_print()
+static void buffer_flush_task(void *arg)
 {
-    xSemaphoreTake(buffer_semaphore, portMAX_DELAY);
-
-    ESP_LOGI(TAG, "Buffer content:");
-    for (int i = 0; i < buffer.count; i++)
+    while (1)
     {
-        int index = (buffer.tail + i) % BUFFER_SIZE;
-        ESP_LOGI(TAG, "%d: Event: %s, Song ID: %d", i, getEventName(buffer.data[index].event), buffer.data[index].song_id);
+        // Several writes arriving while we commit collapse into one more pass
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        buffer_persist();
     }
-
-    xSemaphoreGive(buffer_semaphore);
 }
 
-void buffer_write(EventType event, uint8_t song_id)
+static void buffer_request_flush(void)
 {
-    xSemaphoreTake(buffer_semaphore, portMAX_DELAY);
-
-    nvs_handle_t logger;
-    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &logger);
-    if (err != ESP_OK)
+    if (flush_task_handle != NULL)
     {
-        ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
-        xSemaphoreGive(buffer_semaphore);
-        return;
+        xTaskNotifyGive(flush_task_handle);
     }
+}
 
-    time_t now;
-    time(&now);
-
-    buffer.data[buffer.head].event = event;
-    buffer.data[buffer.head].song_id = song_id;
-    buffer.data[buffer.head].timestamp = now;
-    buffer.head = (buffer.head + 1) % BUFFER_SIZE;
-
-    if (buffer.count == BUFFER_SIZE)
-    {
-        buffer.tail = (buffer.tail + 1) % BUFFER_SIZE;
-    }
-    else
+static void buffer_notify_subscribers(void)
+{
+    int count = atomic_load_explicit(&subscriber_count, memory_order_acquire);
+    for (int i = 0; i < count; i++)
     {
-        buffer.count++;
+        xTaskNotifyGive(subscribers[i]);
     }
+}
 
-    err = nvs_set_blob(logger, "buffer", &buffer, sizeof(circular_buffer_t));
-    if (err != ESP_OK)
-    {
-        ESP_LOGE(TAG, "Error (%s) writing buffer to NVS", esp_err_to_name(err));
-    }
-    else
+esp_err_t logger_subscribe(TaskHandle_t task)
+{
+    esp_err_t ret = ESP_ERR_NO_MEM;
+
+    portENTER_CRITICAL(&subscribers_lock);
+    int index = atomic_load_explicit(&subscriber_count, memory_order_relaxed);
+    if (index < LOGGER_MAX_SUBSCRIBERS)
     {
-        nvs_commit(logger);
+        subscribers[index] = task;
+        atomic_store_explicit(&subscriber_count, index + 1, memory_order_release);
+        ret = ESP_OK;
     }
+    portEXIT_CRITICAL(&subscribers_lock);
 
-    nvs_close(logger);
-    ESP_LOGI(TAG, "Written event: %s, song ID: %d, timestamp: %lld to buffer", getEventName(event), song_id, (long long)now);
+    return ret;
+}
 
-    xSemaphoreGive(buffer_semaphore);
+uint32_t buffer_cursor(void)
+{
+    return atomic_load_explicit(&ring.head, memory_order_acquire);
 }
 
-void buffer_init()
+size_t buffer_read_since(uint32_t *cursor, buffer_entry_t *entries, size_t max)
 {
-    nvs_handle_t logger;
-    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &logger);
-    if (err != ESP_OK)
+    return log_ring_read_from(&ring, cursor, entries, max);
+}
+
+uint8_t buffer_read(buffer_entry_t *entry)
+{
+    if (!log_ring_pop(&ring, entry))
     {
-        ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
-        return;
+        ESP_LOGI(TAG, "Buffer is empty");
+        return 0;
     }
 
-    size_t required_size = sizeof(circular_buffer_t);
-    err = nvs_get_blob(logger, "buffer", &buffer, &required_size);
+    buffer_request_flush();
+    ESP_LOGI(TAG, "Read event: %s, song ID: %d", getEventName(entry->event), entry->song_id);
+    return 1;
+}
 
-    if (err == ESP_ERR_NVS_NOT_FOUND)
-    {
-        ESP_LOGI(TAG, "Buffer not found, initializing a new one");
-        memset(&buffer, 0, sizeof(circular_buffer_t));
-        nvs_set_blob(logger, "buffer", &buffer, sizeof(circular_buffer_t));
-        nvs_commit(logger);
-    }
-    else if (err != ESP_OK)
+void buffer_print()
+{
+    buffer_entry_t entries[BUFFER_SIZE];
+    size_t count = log_ring_snapshot(&ring, entries, BUFFER_SIZE);
+
+    ESP_LOGI(TAG, "Buffer content:");
+    for (int i = 0; i < count; i++)
     {
-        ESP_LOGE(TAG, "Error reading buffer from NVS");
-    }
-    else
-    {
-        ESP_LOGI(TAG, "Buffer loaded from NVS");
+        ESP_LOGI(TAG, "%d: Event: %s, Song ID: %d", i, getEventName(entries[i].event), entries[i].song_id);
     }
+}
 
-    nvs_close(logger);
+void buffer_write(EventType event, uint8_t song_id)
+{
+    time_t now;
+    time(&now);
+
+    buffer_entry_t entry = {
+        .event = event,
+        .song_id = song_id,
+        .timestamp = now};
+    log_ring_push(&ring, &entry);
+    buffer_request_flush();
+    buffer_notify_subscribers();
+
+    ESP_LOGI(TAG, "Written event: %s, song ID: %d, timestamp: %lld to buffer", getEventName(event), song_id, (long long)now);
 }
 
-circular_buffer_t get_buffer_from_nvs()
+void buffer_init()
 {
     nvs_handle_t logger;
     esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &logger);
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
+        return;
     }
 
-    circular_buffer_t local_buffer;
+    circular_buffer_t stored;
     size_t required_size = sizeof(circular_buffer_t);
-    err = nvs_get_blob(logger, "buffer", &local_buffer, &required_size);
+    err = nvs_get_blob(logger, "buffer", &stored, &required_size);
+
+    log_ring_reset(&ring);
 
     if (err == ESP_ERR_NVS_NOT_FOUND)
     {
         ESP_LOGI(TAG, "Buffer not found, initializing a new one");
-        memset(&local_buffer, 0, sizeof(circular_buffer_t));
+        memset(&stored, 0, sizeof(circular_buffer_t));
+        nvs_set_blob(logger, "buffer", &stored, sizeof(circular_buffer_t));
+        nvs_commit(logger);
     }
     else if (err != ESP_OK)
     {
@@ -261,27 +265,19 @@ circular_buffer_t get_buffer_from_nvs()
     }
     else
     {
+        for (int i = 0; i < stored.count && i < BUFFER_SIZE; i++)
+        {
+            log_ring_push(&ring, &stored.data[(stored.tail + i) % BUFFER_SIZE]);
+        }
         ESP_LOGI(TAG, "Buffer loaded from NVS");
     }
 
     nvs_close(logger);
-    return local_buffer;
 }
 
 uint8_t get_last_entry(buffer_entry_t *entry)
 {
-    xSemaphoreTake(buffer_semaphore, portMAX_DELAY);
-
-    if (buffer.count == 0)
-    {
-        xSemaphoreGive(buffer_semaphore);
-        return 0;
-    }
-
-    *entry = buffer.data[(buffer.head - 1 + BUFFER_SIZE) % BUFFER_SIZE];
-
-    xSemaphoreGive(buffer_semaphore);
-    return 1;
+    return log_ring_last(&ring, entry);
 }
 
 
@@ -291,17 +287,26 @@ const char *EventNames[] = {
     "PREVIOUS",
     "STOP",
     "VOLUME_UP",
-    "VOLUME_DOWN"};
+    "VOLUME_DOWN",
+    "VOLUME_SET",
+    "TRACK_SELECT",
+    "SEEK"};
 
 const char *getEventName(EventType event)
 {
-    return EventNames[event];
+    // Negative values wrap to large ones, whatever signedness the enum got
+    unsigned index = (unsigned)event;
+    if (index >= sizeof(EventNames) / sizeof(EventNames[0]))
+    {
+        return "UNKNOWN";
+    }
+    return EventNames[index];
 }
 
 void init_logger(void)
 {
-    buffer_semaphore = xSemaphoreCreateMutex();
     buffer_init();
+    xTaskCreate(buffer_flush_task, "logger_flush_task", 3072, NULL, 3, &flush_task_handle);
 
 
     char *json_string = buffer_to_json();
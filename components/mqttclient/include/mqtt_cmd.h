@@ -0,0 +1,41 @@
+#ifndef MQTT_CMD_H
+#define MQTT_CMD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Fixed-schema decoder for command payloads, no heap and no NUL terminator
+ * needed. Two encodings are accepted:
+ *
+ *   JSON    {"event":N,"song_id":M[,"value":V]}, other scalar keys ignored
+ *   binary  MQTT_CMD_MAGIC, event, song_id[, value int32 little endian]
+ */
+#define MQTT_CMD_MAGIC 0xA5
+#define MQTT_CMD_BINARY_LEN 3
+#define MQTT_CMD_BINARY_VALUE_LEN 7
+
+typedef struct
+{
+    int32_t event;
+    int32_t song_id;
+    int32_t value;
+    bool has_value;
+} mqtt_cmd_t;
+
+/**
+ * @brief Decode a command payload of `len` bytes
+ *
+ * @return true if `event` and `song_id` were both present
+ */
+bool mqtt_cmd_parse(const char *data, size_t len, mqtt_cmd_t *cmd);
+
+/**
+ * @brief Minified JSON form of a command, as used for the echo
+ *
+ * @return length written (excluding NUL), or -1 if it doesn't fit
+ */
+int mqtt_cmd_format(const mqtt_cmd_t *cmd, char *buf, size_t len);
+
+#endif // MQTT_CMD_H
@@ -0,0 +1,33 @@
+#ifndef MQTT_TELEMETRY_H
+#define MQTT_TELEMETRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/*
+ * Batches logger events and player metrics into minified JSON messages:
+ *   <topic>/events   {"e":[[event,song_id,timestamp],...]}   QoS 1
+ *   <topic>/metrics  {"s":..,"v":..,"p":..,"pos":..,"u":..}  QoS 0
+ * Events produced while the broker is unreachable go to a backlog blob in
+ * NVS, away from the SPIFFS partition the tracks play from, and are drained
+ * once the client reconnects.
+ */
+
+/**
+ * @brief Start the telemetry task, a no-op if it is already running. It
+ *        publishes through mqtt_app_publish(), so it follows client changes.
+ *        Topic and interval default to the Kconfig values.
+ */
+esp_err_t mqtt_telemetry_start(void);
+
+/**
+ * @brief Change the base topic and/or publish interval at runtime.
+ *        Pass NULL / 0 to keep the current value.
+ */
+void mqtt_telemetry_configure(const char *topic, uint32_t interval_ms);
+
+/*!< Called from the MQTT event handler on (dis)connection */
+void mqtt_telemetry_set_connected(bool connected);
+
+#endif // MQTT_TELEMETRY_H
@@ -1,4 +1,16 @@
 
 #include "esp_err.h"
 
+/*!< (Re)configure the client and persist broker/topic, a no-op if they didn't change */
 esp_err_t mqtt_app_start(const char *broker, const char *topic);
+
+/*!< Call once the station has an IP: reconnects now, or starts from the stored settings */
+esp_err_t mqtt_app_resume(void);
+
+/**
+ * @brief Publish on the managed client. Takes the client lock, so it is safe
+ *        against the client being replaced; not for use from MQTT event handlers.
+ *
+ * @return msg_id as esp_mqtt_client_publish(), -1 if there is no client
+ */
+int mqtt_app_publish(const char *topic, const char *data, int len, int qos);
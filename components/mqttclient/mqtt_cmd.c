@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <string.h>
+#include "mqtt_cmd.h"
+
+typedef struct
+{
+    const char *p;
+    const char *end;
+} cursor_t;
+
+static void skip_ws(cursor_t *c)
+{
+    while (c->p < c->end && (*c->p == ' ' || *c->p == '\t' || *c->p == '\r' || *c->p == '\n'))
+    {
+        c->p++;
+    }
+}
+
+static bool expect(cursor_t *c, char ch)
+{
+    skip_ws(c);
+    if (c->p < c->end && *c->p == ch)
+    {
+        c->p++;
+        return true;
+    }
+    return false;
+}
+
+/*!< Points `str` at the contents of a string token, escapes are skipped over verbatim */
+static bool parse_string(cursor_t *c, const char **str, size_t *len)
+{
+    if (!expect(c, '"'))
+    {
+        return false;
+    }
+
+    const char *start = c->p;
+    while (c->p < c->end && *c->p != '"')
+    {
+        if (*c->p == '\\')
+        {
+            c->p++;
+        }
+        c->p++;
+    }
+    if (c->p >= c->end)
+    {
+        return false;
+    }
+
+    *str = start;
+    *len = c->p - start;
+    c->p++;
+    return true;
+}
+
+static bool parse_int(cursor_t *c, int32_t *out)
+{
+    skip_ws(c);
+
+    bool negative = false;
+    if (c->p < c->end && *c->p == '-')
+    {
+        negative = true;
+        c->p++;
+    }
+
+    int64_t value = 0;
+    const char *start = c->p;
+    while (c->p < c->end && *c->p >= '0' && *c->p <= '9')
+    {
+        value = value * 10 + (*c->p - '0');
+        if (value > INT32_MAX)
+        {
+            return false;
+        }
+        c->p++;
+    }
+    if (c->p == start)
+    {
+        return false;
+    }
+
+    // Accept 5.0 style numbers, the fraction is dropped like cJSON's valueint
+    if (c->p < c->end && *c->p == '.')
+    {
+        c->p++;
+        while (c->p < c->end && *c->p >= '0' && *c->p <= '9')
+        {
+            c->p++;
+        }
+    }
+
+    *out = negative ? -value : value;
+    return true;
+}
+
+/*!< Skip a scalar value of a key we don't care about */
+static bool skip_value(cursor_t *c)
+{
+    skip_ws(c);
+    if (c->p >= c->end)
+    {
+        return false;
+    }
+
+    if (*c->p == '"')
+    {
+        const char *str;
+        size_t len;
+        return parse_string(c, &str, &len);
+    }
+
+    const char *start = c->p;
+    while (c->p < c->end && *c->p != ',' && *c->p != '}' && *c->p != '{' && *c->p != '[')
+    {
+        c->p++;
+    }
+    return c->p != start && c->p < c->end && *c->p != '{' && *c->p != '[';
+}
+
+static bool key_is(const char *key, size_t len, const char *name)
+{
+    return strlen(name) == len && memcmp(key, name, len) == 0;
+}
+
+static bool parse_json(const char *data, size_t len, mqtt_cmd_t *cmd)
+{
+    cursor_t c = {.p = data, .end = data + len};
+    bool has_event = false;
+    bool has_song_id = false;
+
+    if (!expect(&c, '{'))
+    {
+        return false;
+    }
+    if (expect(&c, '}'))
+    {
+        return false;
+    }
+
+    do
+    {
+        const char *key;
+        size_t key_len;
+        if (!parse_string(&c, &key, &key_len) || !expect(&c, ':'))
+        {
+            return false;
+        }
+
+        bool ok;
+        if (key_is(key, key_len, "event"))
+        {
+            ok = has_event = parse_int(&c, &cmd->event);
+        }
+        else if (key_is(key, key_len, "song_id"))
+        {
+            ok = has_song_id = parse_int(&c, &cmd->song_id);
+        }
+        else if (key_is(key, key_len, "value"))
+        {
+            ok = cmd->has_value = parse_int(&c, &cmd->value);
+        }
+        else
+        {
+            ok = skip_value(&c);
+        }
+
+        if (!ok)
+        {
+            return false;
+        }
+    } while (expect(&c, ','));
+
+    if (!expect(&c, '}'))
+    {
+        return false;
+    }
+
+    // Only whitespace may follow the object
+    skip_ws(&c);
+    return c.p == c.end && has_event && has_song_id;
+}
+
+static bool parse_binary(const uint8_t *data, size_t len, mqtt_cmd_t *cmd)
+{
+    if (len != MQTT_CMD_BINARY_LEN && len != MQTT_CMD_BINARY_VALUE_LEN)
+    {
+        return false;
+    }
+
+    cmd->event = data[1];
+    cmd->song_id = data[2];
+    if (len == MQTT_CMD_BINARY_VALUE_LEN)
+    {
+        cmd->value = (int32_t)((uint32_t)data[3] | (uint32_t)data[4] << 8 |
+                               (uint32_t)data[5] << 16 | (uint32_t)data[6] << 24);
+        cmd->has_value = true;
+    }
+    return true;
+}
+
+bool mqtt_cmd_parse(const char *data, size_t len, mqtt_cmd_t *cmd)
+{
+    memset(cmd, 0, sizeof(mqtt_cmd_t));
+
+    if (data == NULL || len == 0)
+    {
+        return false;
+    }
+
+    if ((uint8_t)data[0] == MQTT_CMD_MAGIC)
+    {
+        return parse_binary((const uint8_t *)data, len, cmd);
+    }
+
+    return parse_json(data, len, cmd);
+}
+
+int mqtt_cmd_format(const mqtt_cmd_t *cmd, char *buf, size_t len)
+{
+    int n;
+
+    if (cmd->has_value)
+    {
+        n = snprintf(buf, len, "{\"event\":%d,\"song_id\":%d,\"value\":%d}",
+                     (int)cmd->event, (int)cmd->song_id, (int)cmd->value);
+    }
+    else
+    {
+        n = snprintf(buf, len, "{\"event\":%d,\"song_id\":%d}", (int)cmd->event, (int)cmd->song_id);
+    }
+
+    return n >= 0 && (size_t)n < len ? n : -1;
+}
@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "mqtt_telemetry.h"
+#include "mqttclient.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "logger.h"
+#include "audio.h"
+#include "player_state.h"
+#include "config.h"
+
+static const char *TAG = "mqtt_telemetry";
+
+#define TELEMETRY_TOPIC_LEN 128
+#define TELEMETRY_BATCH_MAX BUFFER_SIZE
+#define TELEMETRY_PAYLOAD_LEN 768
+#define TELEMETRY_NVS_NAMESPACE "telemetry"
+#define TELEMETRY_BACKLOG_KEY "backlog"
+#define TELEMETRY_BACKLOG_MAX 128
+
+/*!< Backlog record as stored in NVS, 10 bytes */
+typedef struct __attribute__((packed))
+{
+    uint8_t event;
+    uint8_t song_id;
+    int64_t timestamp;
+} telemetry_record_t;
+
+static TaskHandle_t telemetry_task_handle = NULL;
+static atomic_bool telemetry_connected;
+static atomic_bool telemetry_drain;
+static atomic_bool telemetry_enabled = true;
+
+static portMUX_TYPE telemetry_lock = portMUX_INITIALIZER_UNLOCKED;
+static char telemetry_topic[TELEMETRY_TOPIC_LEN] = CONFIG_MQTT_TELEMETRY_TOPIC;
+static uint32_t telemetry_interval_ms = CONFIG_MQTT_TELEMETRY_INTERVAL_MS;
+
+static telemetry_record_t pending[TELEMETRY_BATCH_MAX];
+static size_t pending_count = 0;
+
+/*!< RAM copy of the NVS backlog, only touched by the telemetry task */
+static telemetry_record_t backlog[TELEMETRY_BACKLOG_MAX];
+static size_t backlog_stored = 0;
+
+static void telemetry_get_topic(char *topic, size_t len, const char *suffix)
+{
+    portENTER_CRITICAL(&telemetry_lock);
+    snprintf(topic, len, "%s/%s", telemetry_topic, suffix);
+    portEXIT_CRITICAL(&telemetry_lock);
+}
+
+static uint32_t telemetry_get_interval(void)
+{
+    portENTER_CRITICAL(&telemetry_lock);
+    uint32_t interval_ms = telemetry_interval_ms;
+    portEXIT_CRITICAL(&telemetry_lock);
+
+    return interval_ms;
+}
+
+static void backlog_load(void)
+{
+    nvs_handle_t handle;
+    size_t size = sizeof(backlog);
+
+    backlog_stored = 0;
+    if (nvs_open(TELEMETRY_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+    {
+        return;
+    }
+    if (nvs_get_blob(handle, TELEMETRY_BACKLOG_KEY, backlog, &size) == ESP_OK)
+    {
+        backlog_stored = size / sizeof(telemetry_record_t);
+        ESP_LOGI(TAG, "%d offline events from before the restart", (int)backlog_stored);
+    }
+    nvs_close(handle);
+}
+
+/*!< Write the RAM backlog to NVS, which keeps the old blob until the new one is complete */
+static void backlog_save(void)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(TELEMETRY_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
+        return;
+    }
+
+    if (backlog_stored > 0)
+    {
+        err = nvs_set_blob(handle, TELEMETRY_BACKLOG_KEY, backlog, backlog_stored * sizeof(telemetry_record_t));
+    }
+    else
+    {
+        err = nvs_erase_key(handle, TELEMETRY_BACKLOG_KEY);
+        err = err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+    }
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(handle);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error (%s) writing backlog to NVS", esp_err_to_name(err));
+    }
+
+    nvs_close(handle);
+}
+
+static void backlog_append(const telemetry_record_t *records, size_t count)
+{
+    size_t room = TELEMETRY_BACKLOG_MAX - backlog_stored;
+    if (count > room)
+    {
+        ESP_LOGW(TAG, "Backlog full, dropping %d events", (int)(count - room));
+        count = room;
+    }
+    if (count == 0)
+    {
+        return;
+    }
+
+    memcpy(&backlog[backlog_stored], records, count * sizeof(telemetry_record_t));
+    backlog_stored += count;
+    backlog_save();
+
+    ESP_LOGI(TAG, "Stored %d events offline (%d total)", (int)count, (int)backlog_stored);
+}
+
+/*!< Minified events batch, returns the payload length or -1 if it doesn't fit */
+static int format_events(char *buf, size_t len, const telemetry_record_t *records, size_t count)
+{
+    int pos = snprintf(buf, len, "{\"e\":[");
+
+    for (size_t i = 0; i < count && pos < (int)len; i++)
+    {
+        pos += snprintf(buf + pos, len - pos, "%s[%d,%d,%lld]", i ? "," : "",
+                        records[i].event, records[i].song_id, (long long)records[i].timestamp);
+    }
+    if (pos < (int)len)
+    {
+        pos += snprintf(buf + pos, len - pos, "]}");
+    }
+
+    return pos < (int)len ? pos : -1;
+}
+
+static bool publish_events(const telemetry_record_t *records, size_t count)
+{
+    static char payload[TELEMETRY_PAYLOAD_LEN];
+    char topic[TELEMETRY_TOPIC_LEN + 8];
+
+    int len = format_events(payload, sizeof(payload), records, count);
+    if (len < 0)
+    {
+        ESP_LOGE(TAG, "Events batch too large");
+        return false;
+    }
+
+    telemetry_get_topic(topic, sizeof(topic), "events");
+    return mqtt_app_publish(topic, payload, len, 1) >= 0;
+}
+
+static void publish_metrics(void)
+{
+    char payload[96];
+    char topic[TELEMETRY_TOPIC_LEN + 8];
+    player_state_t state;
+    player_state_get(&state);
+
+    int len = snprintf(payload, sizeof(payload), "{\"s\":%d,\"v\":%d,\"p\":%d,\"pos\":%u,\"u\":%u}",
+                       state.song_id, state.volume, state.play_state,
+                       (unsigned)state.position_ms, (unsigned)audio_get_underrun_count());
+
+    telemetry_get_topic(topic, sizeof(topic), "metrics");
+    mqtt_app_publish(topic, payload, len, 0);
+}
+
+/*!< Send the backlog in batches, whatever can't be sent stays stored */
+static void backlog_drain(void)
+{
+    size_t count = backlog_stored;
+    size_t sent = 0;
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    while (sent < count && atomic_load(&telemetry_connected))
+    {
+        size_t batch = count - sent < TELEMETRY_BATCH_MAX ? count - sent : TELEMETRY_BATCH_MAX;
+        if (!publish_events(&backlog[sent], batch))
+        {
+            break;
+        }
+        sent += batch;
+    }
+
+    // A reset before this lands resends the batches already out, never loses the rest
+    if (sent > 0)
+    {
+        memmove(backlog, &backlog[sent], (count - sent) * sizeof(telemetry_record_t));
+        backlog_stored = count - sent;
+        backlog_save();
+    }
+
+    ESP_LOGI(TAG, "Drained %d of %d offline events", (int)sent, (int)count);
+}
+
+static void flush_pending(void)
+{
+    if (pending_count == 0)
+    {
+        return;
+    }
+    if (!atomic_load(&telemetry_enabled))
+    {
+        pending_count = 0;
+        return;
+    }
+
+    if (!atomic_load(&telemetry_connected) || !publish_events(pending, pending_count))
+    {
+        backlog_append(pending, pending_count);
+    }
+    pending_count = 0;
+}
+
+static void telemetry_task(void *arg)
+{
+    backlog_load();
+
+    uint32_t cursor = buffer_cursor();
+    TickType_t next_flush = xTaskGetTickCount() + pdMS_TO_TICKS(telemetry_get_interval());
+
+    while (1)
+    {
+        TickType_t now = xTaskGetTickCount();
+        TickType_t wait = (int32_t)(next_flush - now) > 0 ? next_flush - now : 0;
+
+        // Woken by new logger entries and connection changes
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        buffer_entry_t entries[BUFFER_SIZE];
+        size_t count;
+        while ((count = buffer_read_since(&cursor, entries, BUFFER_SIZE)) > 0)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                if (pending_count == TELEMETRY_BATCH_MAX)
+                {
+                    flush_pending();
+                }
+                pending[pending_count].event = entries[i].event;
+                pending[pending_count].song_id = entries[i].song_id;
+                pending[pending_count].timestamp = entries[i].timestamp;
+                pending_count++;
+            }
+        }
+
+        if (atomic_exchange(&telemetry_drain, false) && atomic_load(&telemetry_connected))
+        {
+            backlog_drain();
+        }
+
+        if ((int32_t)(xTaskGetTickCount() - next_flush) >= 0)
+        {
+            flush_pending();
+            if (atomic_load(&telemetry_connected) && atomic_load(&telemetry_enabled))
+            {
+                publish_metrics();
+            }
+            next_flush = xTaskGetTickCount() + pdMS_TO_TICKS(telemetry_get_interval());
+        }
+    }
+}
+
+void mqtt_telemetry_configure(const char *topic, uint32_t interval_ms)
+{
+    portENTER_CRITICAL(&telemetry_lock);
+    if (topic != NULL)
+    {
+        strncpy(telemetry_topic, topic, sizeof(telemetry_topic) - 1);
+        telemetry_topic[sizeof(telemetry_topic) - 1] = '\0';
+    }
+    if (interval_ms > 0)
+    {
+        telemetry_interval_ms = interval_ms;
+    }
+    portEXIT_CRITICAL(&telemetry_lock);
+}
+
+void mqtt_telemetry_set_connected(bool connected)
+{
+    atomic_store(&telemetry_connected, connected);
+    if (connected)
+    {
+        // The task knows whether there is a backlog, an empty one drains as a no-op
+        atomic_store(&telemetry_drain, true);
+    }
+
+    if (telemetry_task_handle != NULL)
+    {
+        xTaskNotifyGive(telemetry_task_handle);
+    }
+}
+
+/*!< Settings from the config store, Kconfig values are the schema defaults */
+static void telemetry_config_changed(const char *key, const char *value, void *arg)
+{
+    char topic[TELEMETRY_TOPIC_LEN];
+    int32_t interval_ms;
+    bool enabled;
+
+    if (config_get_value("tlm_topic", topic, sizeof(topic)) == ESP_OK &&
+        config_get_int("tlm_interval", &interval_ms) == ESP_OK)
+    {
+        mqtt_telemetry_configure(topic, interval_ms);
+    }
+    if (config_get_bool("tlm_enabled", &enabled) == ESP_OK)
+    {
+        atomic_store(&telemetry_enabled, enabled);
+    }
+}
+
+esp_err_t mqtt_telemetry_start(void)
+{
+    if (telemetry_task_handle != NULL)
+    {
+        return ESP_OK;
+    }
+
+    if (xTaskCreate(telemetry_task, "mqtt_telemetry", 4096, NULL, 3, &telemetry_task_handle) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create telemetry task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    telemetry_config_changed(NULL, NULL, NULL);
+    ESP_ERROR_CHECK(config_subscribe("tlm_topic", telemetry_config_changed, NULL));
+    ESP_ERROR_CHECK(config_subscribe("tlm_interval", telemetry_config_changed, NULL));
+    ESP_ERROR_CHECK(config_subscribe("tlm_enabled", telemetry_config_changed, NULL));
+
+    if (logger_subscribe(telemetry_task_handle) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "No logger subscriber slot, events go out on the interval only");
+    }
+
+    char topic[TELEMETRY_TOPIC_LEN + 8];
+    telemetry_get_topic(topic, sizeof(topic), "*");
+    ESP_LOGI(TAG, "Publishing to %s every %u ms", topic, (unsigned)telemetry_get_interval());
+    return ESP_OK;
+}
@@ -1,23 +1,66 @@
+#include <stdio.h>
+#include <string.h>
 #include "mqttclient.h"
+#include "mqtt_telemetry.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "mqtt_client.h"
 #include "logger.h"
-#include "cJSON.h"
+#include "mqtt_cmd.h"
 #include "audio.h"
+#include "player_state.h"
+#include "command_router.h"
+#include "config.h"
 
 static const char *TAG = "MQTT_EXAMPLE";
 
 esp_mqtt_client_handle_t client = NULL;
 static char subscribed_topic[256]; // Buffer to store the subscribed topic
+static char broker_uri[256];
+
+/*
+ * One managed client, settings persisted in the config store. The library's
+ * fixed-interval reconnect is disabled in favour of exponential backoff, so
+ * every path that gives up on a reconnect attempt must schedule the next.
+ */
+#define MQTT_KEY_BROKER "broker"
+#define MQTT_KEY_TOPIC "topic"
+#define BACKOFF_MIN_MS 1000
+#define BACKOFF_MAX_MS 60000
+#define KEEPALIVE_S 30
+
+static SemaphoreHandle_t client_lock = NULL;
+static esp_timer_handle_t reconnect_timer = NULL;
+static uint32_t backoff_ms = BACKOFF_MIN_MS;
+
+/*
+ * Commands whose QoS 1 echo hasn't been acked yet, keyed by the msg_id of
+ * the echo. Each one is logged when its own ack comes back. Retransmission
+ * is left to the client's outbox, which resends unacked QoS 1 messages
+ * with the same msg_id; entries still unacked after the outbox would have
+ * expired them are given up on.
+ */
+#define INFLIGHT_MAX 8
+#define INFLIGHT_TIMEOUT_US (30 * 1000 * 1000)
+#define INFLIGHT_PAYLOAD_LEN 128
+#define ECHO_TOPIC "topic"
 
 typedef struct
 {
+    bool used;
+    int msg_id;
     EventType event;
     uint8_t song_id;
-} pending_event_t;
+    int64_t sent_us;
+} inflight_t;
 
-static pending_event_t pending_event;
-static bool pending_event_active = false;
+static inflight_t inflight[INFLIGHT_MAX];
+static SemaphoreHandle_t inflight_lock = NULL;
+static esp_timer_handle_t inflight_timer = NULL;
+static bool connected = false;
 
 static void log_error_if_nonzero(const char *message, int error_code)
 {
@@ -27,6 +70,150 @@ static void log_error_if_nonzero(const char *message, int error_code)
     }
 }
 
+/*!< Track an echo, returns false when the table is full */
+static bool inflight_add(int msg_id, EventType event, uint8_t song_id)
+{
+    bool added = false;
+
+    xSemaphoreTake(inflight_lock, portMAX_DELAY);
+    for (int i = 0; i < INFLIGHT_MAX; i++)
+    {
+        if (!inflight[i].used)
+        {
+            inflight[i].used = true;
+            inflight[i].msg_id = msg_id;
+            inflight[i].event = event;
+            inflight[i].song_id = song_id;
+            inflight[i].sent_us = esp_timer_get_time();
+            added = true;
+            break;
+        }
+    }
+    xSemaphoreGive(inflight_lock);
+
+    return added;
+}
+
+static void inflight_ack(int msg_id)
+{
+    bool found = false;
+    EventType event = 0;
+    uint8_t song_id = 0;
+
+    xSemaphoreTake(inflight_lock, portMAX_DELAY);
+    for (int i = 0; i < INFLIGHT_MAX; i++)
+    {
+        if (inflight[i].used && inflight[i].msg_id == msg_id)
+        {
+            inflight[i].used = false;
+            event = inflight[i].event;
+            song_id = inflight[i].song_id;
+            found = true;
+            break;
+        }
+    }
+    xSemaphoreGive(inflight_lock);
+
+    if (found)
+    {
+        buffer_write(event, song_id);
+        ESP_LOGI(TAG, "Logged event after ack: %s, Song ID: %d", getEventName(event), song_id);
+    }
+    else
+    {
+        ESP_LOGD(TAG, "Ack for untracked msg_id=%d", msg_id);
+    }
+}
+
+/*
+ * Periodic: drop echoes whose ack is long overdue. Only inflight_lock is
+ * taken here, never the client, so this can't deadlock against the MQTT
+ * task, which holds its API lock while inflight_ack() runs.
+ */
+static void inflight_timeout_cb(void *arg)
+{
+    int64_t now = esp_timer_get_time();
+
+    // The outbox only resends once connected, don't count the time offline
+    if (!connected)
+    {
+        xSemaphoreTake(inflight_lock, portMAX_DELAY);
+        for (int i = 0; i < INFLIGHT_MAX; i++)
+        {
+            inflight[i].sent_us = now;
+        }
+        xSemaphoreGive(inflight_lock);
+        return;
+    }
+
+    xSemaphoreTake(inflight_lock, portMAX_DELAY);
+    for (int i = 0; i < INFLIGHT_MAX; i++)
+    {
+        if (inflight[i].used && now - inflight[i].sent_us >= INFLIGHT_TIMEOUT_US)
+        {
+            ESP_LOGW(TAG, "No ack for %s (msg_id=%d), giving up", getEventName(inflight[i].event), inflight[i].msg_id);
+            inflight[i].used = false;
+        }
+    }
+    xSemaphoreGive(inflight_lock);
+}
+
+/*!< Log whatever is still waiting for an ack, used when the client goes away */
+static void inflight_flush(void)
+{
+    xSemaphoreTake(inflight_lock, portMAX_DELAY);
+    for (int i = 0; i < INFLIGHT_MAX; i++)
+    {
+        if (inflight[i].used)
+        {
+            buffer_write(inflight[i].event, inflight[i].song_id);
+            inflight[i].used = false;
+        }
+    }
+    xSemaphoreGive(inflight_lock);
+}
+
+static void schedule_reconnect(void)
+{
+    uint32_t delay_ms = backoff_ms + esp_random() % (backoff_ms / 4 + 1);
+
+    esp_timer_stop(reconnect_timer);
+    esp_timer_start_once(reconnect_timer, (uint64_t)delay_ms * 1000);
+    ESP_LOGI(TAG, "Reconnect in %u ms", (unsigned)delay_ms);
+
+    backoff_ms = backoff_ms * 2 > BACKOFF_MAX_MS ? BACKOFF_MAX_MS : backoff_ms * 2;
+}
+
+/*!< Ask the client to reconnect now, caller holds client_lock */
+static void reconnect_now(void)
+{
+    // Refused unless the client is waiting to reconnect, e.g. while a
+    // connect is still under way. A refusal raises no event, so try again
+    // later or nothing would ever schedule the next attempt.
+    if (esp_mqtt_client_reconnect(client) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Reconnect refused, retrying");
+        schedule_reconnect();
+    }
+}
+
+static void reconnect_timer_cb(void *arg)
+{
+    // Busy publishing or being replaced, don't block the timer task; a
+    // replaced client connects by itself and finds nothing to do here
+    if (xSemaphoreTake(client_lock, 0) != pdTRUE)
+    {
+        schedule_reconnect();
+        return;
+    }
+    if (client != NULL && !connected)
+    {
+        ESP_LOGI(TAG, "Reconnecting to %s", broker_uri);
+        reconnect_now();
+    }
+    xSemaphoreGive(client_lock);
+}
+
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
     ESP_LOGD(TAG, "Event dispatched from event loop base=%s, event_id=%d", base, event_id);
@@ -37,12 +224,22 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     switch ((esp_mqtt_event_id_t)event_id)
     {
     case MQTT_EVENT_CONNECTED:
-        ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
-        msg_id = esp_mqtt_client_subscribe(client, subscribed_topic, 1);
-        ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
+        ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED, session_present=%d", event->session_present);
+        connected = true;
+        backoff_ms = BACKOFF_MIN_MS;
+        mqtt_telemetry_set_connected(true);
+        // A resumed session still has the subscription and queued commands
+        if (!event->session_present)
+        {
+            msg_id = esp_mqtt_client_subscribe(client, subscribed_topic, 1);
+            ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
+        }
         break;
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+        connected = false;
+        mqtt_telemetry_set_connected(false);
+        schedule_reconnect();
         break;
     case MQTT_EVENT_SUBSCRIBED:
         ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
@@ -53,105 +250,58 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     case MQTT_EVENT_PUBLISHED:
         ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
 
-        if (pending_event_active)
-        {
-            buffer_write(pending_event.event, pending_event.song_id);
-            pending_event_active = false;
-            ESP_LOGI(TAG, "Logged event after ack: %s, Song ID: %d",
-                     getEventName(pending_event.event), pending_event.song_id);
-        }
-        else
-        {
-            ESP_LOGE(TAG, "No pending event to log after ack");
-        }
+        inflight_ack(event->msg_id);
         break;
     case MQTT_EVENT_DATA:
         ESP_LOGI(TAG, "MQTT_EVENT_DATA");
         ESP_LOGI(TAG, "TOPIC=%.*s", event->topic_len, event->topic);
         ESP_LOGI(TAG, "DATA=%.*s", event->data_len, event->data);
 
-        if (strncmp(event->topic, subscribed_topic, event->topic_len) != 0)
+        if (event->topic_len != strlen(subscribed_topic) ||
+            strncmp(event->topic, subscribed_topic, event->topic_len) != 0)
         {
             ESP_LOGI(TAG, "Ignoring message from different topic");
             break;
         }
 
-        if (pending_event_active)
+        // Commands are tiny, a fragmented message isn't one of ours
+        if (event->current_data_offset != 0 || event->data_len != event->total_data_len)
         {
-            ESP_LOGW(TAG, "Ignoring message because a previous event is still pending acknowledgment");
+            ESP_LOGE(TAG, "Ignoring fragmented message (%d bytes)", event->total_data_len);
             break;
         }
 
-        // Parse the JSON data
-        cJSON *root = cJSON_Parse(event->data);
-        if (root == NULL)
+        mqtt_cmd_t cmd;
+        if (!mqtt_cmd_parse(event->data, event->data_len, &cmd))
         {
-            ESP_LOGE(TAG, "Failed to parse JSON");
+            ESP_LOGE(TAG, "Invalid command format");
             break;
         }
 
-        // Extract event and song_id
-        cJSON *event_item = cJSON_GetObjectItem(root, "event");
-        cJSON *song_id_item = cJSON_GetObjectItem(root, "song_id");
+        EventType event_type = (EventType)cmd.event;
 
-        if (!cJSON_IsNumber(event_item) || !cJSON_IsNumber(song_id_item))
-        {
-            ESP_LOGE(TAG, "Invalid JSON format");
-            cJSON_Delete(root);
-            break;
-        }
+        // Logged once the echo is acked, against the track actually
+        // playing like the HTTP and touch paths do
+        player_state_t state;
+        player_state_get(&state);
 
-        // // Check if event_item is a valid EventType
-        EventType event_type = (EventType)event_item->valueint;
-        if (event_type < 0 || event_type > 5)
+        esp_err_t err = command_route_event(COMMAND_SOURCE_MQTT, event_type, cmd.has_value, cmd.value);
+        if (err != ESP_OK)
         {
-            ESP_LOGE(TAG, "Unknown event type");
-            cJSON_Delete(root);
+            ESP_LOGE(TAG, "Command %d rejected (%s)", event_type, esp_err_to_name(err));
             break;
         }
 
-        // Store the event temporarily and wait for ack
-        pending_event.event = event_type;
-        pending_event.song_id = song_id_item->valueint;
-        pending_event_active = true;
-
-        audio_command_t command = NONE;
-        if (event_type == 1)
-        {
-            command = NEXT_AUDIO;
-        }
-        else if (event_type == 2)
-        {
-            command = PREVIOUS_AUDIO;
-        }
-        else if (event_type == 0)
-        {
-            command = PLAY_PAUSE_AUDIO;
-        }
-        else if (event_type == 3)
-        {
-            command = STOP_AUDIO;
-        }
-        else if (event_type == 4)
-        {
-            command = VOL_UP_AUDIO;
-        }
-        else if (event_type == 5)
-        {
-            command = VOL_DOWN_AUDIO;
-        }
-        else
+        // Echo with QoS 1, the ack is matched back by msg_id
+        char message[INFLIGHT_PAYLOAD_LEN];
+        int message_len = mqtt_cmd_format(&cmd, message, sizeof(message));
+        msg_id = message_len < 0 ? -1 : esp_mqtt_client_publish(client, ECHO_TOPIC, message, message_len, 1, 0);
+        if (msg_id < 0 || !inflight_add(msg_id, event_type, state.song_id))
         {
-            ESP_LOGW(TAG, "Received unknown eventType: %i", event_type);
+            // Can't wait for an ack, don't lose the event
+            ESP_LOGW(TAG, "Echo not tracked (msg_id=%d), logging now", msg_id);
+            buffer_write(event_type, state.song_id);
         }
-
-        send_command(command);
-        // Publish with QoS 1 to get an acknowledgment
-        char *message = cJSON_Print(root);
-        msg_id = esp_mqtt_client_publish(client, "topic", message, 0, 1, 0);
-        free(message);
-
-        cJSON_Delete(root);
         break;
     case MQTT_EVENT_ERROR:
         ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
@@ -169,27 +319,202 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     }
 }
 
-esp_err_t mqtt_app_start(const char *broker, const char *topic)
+static esp_err_t mqtt_client_setup(const char *broker, const char *topic);
+
+/*!< Broker or topic edited in the config store, e.g. from the web page */
+static void mqtt_config_changed(const char *key, const char *value, void *arg)
+{
+    char broker[sizeof(broker_uri)];
+    char topic[sizeof(subscribed_topic)];
+
+    if (config_get_value(MQTT_KEY_BROKER, broker, sizeof(broker)) == ESP_OK &&
+        config_get_value(MQTT_KEY_TOPIC, topic, sizeof(topic)) == ESP_OK)
+    {
+        mqtt_client_setup(broker, topic);
+    }
+}
+
+static esp_err_t mqtt_app_init_once(void)
 {
+    if (client_lock != NULL)
+    {
+        return ESP_OK;
+    }
+
+    inflight_lock = xSemaphoreCreateMutex();
+    client_lock = xSemaphoreCreateMutex();
+    if (inflight_lock == NULL || client_lock == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    const esp_timer_create_args_t inflight_args = {
+        .callback = inflight_timeout_cb,
+        .name = "mqtt_inflight",
+    };
+    const esp_timer_create_args_t reconnect_args = {
+        .callback = reconnect_timer_cb,
+        .name = "mqtt_reconnect",
+    };
+    if (esp_timer_create(&inflight_args, &inflight_timer) != ESP_OK ||
+        esp_timer_create(&reconnect_args, &reconnect_timer) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    esp_timer_start_periodic(inflight_timer, 1000 * 1000);
+
+    ESP_ERROR_CHECK(config_subscribe(MQTT_KEY_BROKER, mqtt_config_changed, NULL));
+    ESP_ERROR_CHECK(config_subscribe(MQTT_KEY_TOPIC, mqtt_config_changed, NULL));
+
+    return ESP_OK;
+}
+
+/*!< Stop and free the current client, caller holds client_lock */
+static void mqtt_client_teardown(void)
+{
+    if (client == NULL)
+    {
+        return;
+    }
+
+    connected = false;
+    mqtt_telemetry_set_connected(false);
+    esp_timer_stop(reconnect_timer);
+    esp_mqtt_client_stop(client);
+    esp_mqtt_client_destroy(client);
+    client = NULL;
+
+    // Their acks can't arrive any more
+    inflight_flush();
+}
+
+static esp_err_t mqtt_client_setup(const char *broker, const char *topic)
+{
+    esp_err_t err = mqtt_app_init_once();
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    xSemaphoreTake(client_lock, portMAX_DELAY);
+
+    if (client != NULL && strcmp(broker_uri, broker) == 0 && strcmp(subscribed_topic, topic) == 0)
+    {
+        ESP_LOGI(TAG, "Already using %s", broker);
+        xSemaphoreGive(client_lock);
+        return ESP_OK;
+    }
+
+    mqtt_client_teardown();
+
+    strncpy(broker_uri, broker, sizeof(broker_uri) - 1);
+    broker_uri[sizeof(broker_uri) - 1] = '\0';
+    strncpy(subscribed_topic, topic, sizeof(subscribed_topic) - 1);
+    subscribed_topic[sizeof(subscribed_topic) - 1] = '\0';
+
+    // No clean session: the broker keeps our subscription and queued QoS 1
+    // commands while we're away. The default client id is per chip, so stable.
     esp_mqtt_client_config_t mqtt_cfg = {
-        .uri = broker,
+        .uri = broker_uri,
+        .disable_clean_session = true,
+        .disable_auto_reconnect = true,
+        .keepalive = KEEPALIVE_S,
     };
 
     client = esp_mqtt_client_init(&mqtt_cfg);
     if (client == NULL)
     {
         ESP_LOGE(TAG, "Failed to initialize MQTT client");
+        xSemaphoreGive(client_lock);
         return ESP_FAIL;
     }
 
-    strncpy(subscribed_topic, topic, sizeof(subscribed_topic) - 1);
-    subscribed_topic[sizeof(subscribed_topic) - 1] = '\0';
-
+    backoff_ms = BACKOFF_MIN_MS;
     esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
     esp_mqtt_client_start(client);
+    mqtt_telemetry_start();
+
+    xSemaphoreGive(client_lock);
 
     ESP_LOGI(TAG, "Connecting to broker: %s", broker);
     ESP_LOGI(TAG, "Subscribing to topic: %s", topic);
 
     return ESP_OK;
 }
+
+int mqtt_app_publish(const char *topic, const char *data, int len, int qos)
+{
+    int msg_id = -1;
+
+    if (client_lock == NULL)
+    {
+        return -1;
+    }
+
+    xSemaphoreTake(client_lock, portMAX_DELAY);
+    if (client != NULL)
+    {
+        msg_id = esp_mqtt_client_publish(client, topic, data, len, qos, 0);
+    }
+    xSemaphoreGive(client_lock);
+
+    return msg_id;
+}
+
+esp_err_t mqtt_app_start(const char *broker, const char *topic)
+{
+    esp_err_t err = mqtt_app_init_once();
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    // Remembered so mqtt_app_resume() can bring the client back after a
+    // reboot; both keys in one go so subscribers never see half a change
+    const config_kv_t settings[] = {
+        {MQTT_KEY_BROKER, broker},
+        {MQTT_KEY_TOPIC, topic},
+    };
+    if (config_set_values(settings, 2) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to persist MQTT settings");
+    }
+
+    // Already done by the change notification unless nothing changed
+    return mqtt_client_setup(broker, topic);
+}
+
+esp_err_t mqtt_app_resume(void)
+{
+    esp_err_t err = mqtt_app_init_once();
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    xSemaphoreTake(client_lock, portMAX_DELAY);
+    if (client != NULL)
+    {
+        // Network is back, don't sit out the rest of the backoff
+        backoff_ms = BACKOFF_MIN_MS;
+        if (!connected)
+        {
+            esp_timer_stop(reconnect_timer);
+            reconnect_now();
+        }
+        xSemaphoreGive(client_lock);
+        return ESP_OK;
+    }
+    xSemaphoreGive(client_lock);
+
+    char broker[sizeof(broker_uri)];
+    char topic[sizeof(subscribed_topic)];
+    if (config_get_value(MQTT_KEY_BROKER, broker, sizeof(broker)) != ESP_OK ||
+        config_get_value(MQTT_KEY_TOPIC, topic, sizeof(topic)) != ESP_OK)
+    {
+        ESP_LOGI(TAG, "No stored MQTT settings, waiting for /mqtt-connect");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    return mqtt_client_setup(broker, topic);
+}
@@ -3,10 +3,12 @@
 #include "esp_log.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "webserver.h"
 #include "mqttclient.h"
 #include "logger.h"
+#include "config.h"
 
 #define TAG "network"
 #define EXAMPLE_ESP_MAXIMUM_RETRY 10
@@ -15,8 +17,14 @@
 #define EXAMPLE_ESP_WIFI_CHANNEL 1
 #define EXAMPLE_MAX_STA_CONN 4
 
+/*!< Wait for the rest of a settings batch before reconnecting once */
+#define RECONFIGURE_DELAY_US (300 * 1000)
+
 static int s_retry_num = 0;
 static int connected = 0;
+static esp_timer_handle_t reconfigure_timer = NULL;
+/*!< Set while new credentials are applied, our own disconnect isn't retried */
+static volatile bool reconfiguring = false;
 
 static void wifi_event_handler(void *arg, esp_event_base_t event_base,
                                int32_t event_id, void *event_data)
@@ -27,7 +35,14 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base,
     }
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
     {
-        if (s_retry_num < EXAMPLE_ESP_MAXIMUM_RETRY)
+        wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
+        connected = 0;
+        if (reconfiguring && event->reason == WIFI_REASON_ASSOC_LEAVE)
+        {
+            // Left on purpose by network_reconfigure(), it connects by itself
+            reconfiguring = false;
+        }
+        else if (s_retry_num < EXAMPLE_ESP_MAXIMUM_RETRY)
         {
             esp_wifi_connect();
             s_retry_num++;
@@ -40,6 +55,8 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base,
         ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
         s_retry_num = 0;
         connected = 1;
+        reconfiguring = false;
+        mqtt_app_resume();
         ntp_sync_time();
     }
     if (event_id == WIFI_EVENT_AP_STACONNECTED)
@@ -56,6 +73,48 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base,
     }
 }
 
+/*!< Station credentials from the config store, the built-in ones otherwise */
+static void load_sta_config(wifi_config_t *sta_config)
+{
+    char ssid[sizeof(sta_config->sta.ssid)];
+    char password[sizeof(sta_config->sta.password)];
+
+    if (config_get_value("ssid", ssid, sizeof(ssid)) == ESP_OK && ssid[0] != '\0')
+    {
+        memset(sta_config, 0, sizeof(wifi_config_t));
+        memcpy(sta_config->sta.ssid, ssid, strlen(ssid));
+        if (config_get_value("password", password, sizeof(password)) == ESP_OK)
+        {
+            memcpy(sta_config->sta.password, password, strlen(password));
+        }
+    }
+}
+
+/*!< Runs once the ssid / password batch has settled, see network_config_changed */
+static void network_reconfigure(void *arg)
+{
+    wifi_config_t sta_config = {0};
+    esp_wifi_get_config(WIFI_IF_STA, &sta_config);
+    load_sta_config(&sta_config);
+
+    ESP_LOGI(TAG, "Station settings changed, reconnecting to %s", (const char *)sta_config.sta.ssid);
+    reconfiguring = true;
+    s_retry_num = 0;
+    esp_wifi_disconnect();
+    esp_wifi_set_config(WIFI_IF_STA, &sta_config);
+    esp_wifi_connect();
+}
+
+/*
+ * Called once per changed key, so a PATCH of both ssid and password lands
+ * here twice; restarting the timer folds them into a single reconnect.
+ */
+static void network_config_changed(const char *key, const char *value, void *arg)
+{
+    esp_timer_stop(reconfigure_timer);
+    esp_timer_start_once(reconfigure_timer, RECONFIGURE_DELAY_US);
+}
+
 void init_network(void)
 {
 
@@ -98,6 +157,15 @@ void init_network(void)
         },
     };
 
+    load_sta_config(&sta_config);
+    const esp_timer_create_args_t reconfigure_args = {
+        .callback = network_reconfigure,
+        .name = "sta_reconfigure",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&reconfigure_args, &reconfigure_timer));
+    ESP_ERROR_CHECK(config_subscribe("ssid", network_config_changed, NULL));
+    ESP_ERROR_CHECK(config_subscribe("password", network_config_changed, NULL));
+
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &sta_config));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &ap_config));
@@ -13,6 +13,9 @@
 // limitations under the License.
 #pragma once
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -48,6 +51,22 @@ void touch_get_mask(uint32_t *mask);
  */
 void touch_get_flag_status(bool *flag);
 
+#define TOUCH_LATENCY_BUCKETS 16
+
+typedef struct {
+    uint32_t events;    /*!< interrupts stored by the ISR */
+    uint32_t dropped;   /*!< interrupts lost because the ring was full */
+    uint32_t max_depth; /*!< highest ring occupancy seen by the read task */
+    /*!< Latency histograms, bucket i counts [2^i, 2^(i+1)) us (bucket 0 also < 1 us) */
+    uint32_t dispatch_us[TOUCH_LATENCY_BUCKETS]; /*!< ISR to read task */
+    uint32_t command_us[TOUCH_LATENCY_BUCKETS];  /*!< ISR edge to command queued */
+} touch_stats_t;
+
+/**
+ * @brief Copy the touch event counters and latency histograms
+ */
+void touch_get_stats(touch_stats_t *stats);
+
 /**
  * @brief Initialize the touch        
  */
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TOUCH_GESTURE_MAX_PADS 8
+
+typedef enum {
+    TOUCH_GESTURE_TAP,
+    TOUCH_GESTURE_DOUBLE_TAP,
+    TOUCH_GESTURE_LONG_PRESS,
+    TOUCH_GESTURE_REPEAT,       /*!< periodic while a repeat pad is held */
+} touch_gesture_t;
+
+typedef struct {
+    int64_t debounce_us;        /*!< presses closer than this to the last release are bounces */
+    int64_t min_press_us;       /*!< shorter contacts are glitches and ignored */
+    int64_t double_tap_us;      /*!< window for the second tap of a double tap */
+    int64_t long_press_us;      /*!< hold time for a long press */
+    int64_t repeat_delay_us;    /*!< hold time before the first repeat */
+    int64_t repeat_period_us;   /*!< time between repeats after that */
+} touch_gesture_config_t;
+
+#define TOUCH_GESTURE_DEFAULT_CONFIG() { \
+    .debounce_us = 30000,                \
+    .min_press_us = 20000,               \
+    .double_tap_us = 250000,             \
+    .long_press_us = 800000,             \
+    .repeat_delay_us = 400000,           \
+    .repeat_period_us = 150000,          \
+}
+
+/*!< Called once per recognised gesture, `pad` is the index given to touch_gesture_add_pad */
+typedef void (*touch_gesture_cb_t)(int pad, touch_gesture_t gesture, void *arg);
+
+typedef struct {
+    bool repeat;                /*!< tap fires on press and holding repeats, no double/long */
+    bool double_tap;            /*!< wait double_tap_us before reporting a tap */
+    bool pressed;
+    bool long_fired;
+    bool tap_pending;
+    int64_t press_us;
+    int64_t release_us;
+    int64_t tap_us;             /*!< release of the tap waiting for its pair */
+    int64_t next_us;            /*!< next repeat, long press or tap timeout, 0 if none */
+} touch_gesture_pad_t;
+
+typedef struct {
+    touch_gesture_config_t config;
+    touch_gesture_pad_t pads[TOUCH_GESTURE_MAX_PADS];
+    int pad_count;
+    touch_gesture_cb_t cb;
+    void *arg;
+} touch_gesture_engine_t;
+
+void touch_gesture_init(touch_gesture_engine_t *engine, const touch_gesture_config_t *config,
+                        touch_gesture_cb_t cb, void *arg);
+
+/**
+ * @brief Register a pad, returns its index or -1 if the engine is full
+ *
+ * @param repeat     report a tap as soon as the pad is pressed and repeat while held (volume)
+ * @param double_tap recognise double taps (delays single taps by double_tap_us)
+ */
+int touch_gesture_add_pad(touch_gesture_engine_t *engine, bool repeat, bool double_tap);
+
+void touch_gesture_press(touch_gesture_engine_t *engine, int pad, int64_t now_us);
+
+void touch_gesture_release(touch_gesture_engine_t *engine, int pad, int64_t now_us);
+
+/**
+ * @brief Fire the time based gestures (long press, repeat, tap timeout) due at `now_us`
+ *
+ * @return time of the next deadline, or 0 if nothing is pending
+ */
+int64_t touch_gesture_tick(touch_gesture_engine_t *engine, int64_t now_us);
+
+/**
+ * @brief Drop every press in progress without reporting it (e.g. guard ring touched)
+ */
+void touch_gesture_cancel(touch_gesture_engine_t *engine);
+
+#ifdef __cplusplus
+}
+#endif
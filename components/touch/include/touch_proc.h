@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "touch_gesture.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Touch processing without the touch peripheral: guard ring handling,
+ * active / inactive edges, threshold upkeep and gesture recognition.
+ * The driver side is reached only through touch_hal_t, so the same code
+ * runs on the board and on a host fed with recorded traces.
+ */
+
+#define TOUCH_PROC_MAX_PADS TOUCH_GESTURE_MAX_PADS
+
+/*!< Thresholds are re-derived when a pad's baseline drifts this much (percent) */
+#define TOUCH_PROC_DRIFT_PCT        3
+#define TOUCH_PROC_MAINTAIN_US      2000000
+
+/*!< Software detection (touch_proc_sample): release below this share of the threshold */
+#define TOUCH_PROC_HYSTERESIS_PCT   80
+/*!< Software baseline IIR weight, 1 / 2^n of each idle sample */
+#define TOUCH_PROC_BASELINE_SHIFT   3
+
+typedef struct {
+    uint32_t (*read_baseline)(void *ctx, int pad);
+    void (*set_threshold)(void *ctx, int pad, uint32_t threshold);
+    void (*gesture)(void *ctx, int pad, touch_gesture_t gesture);
+    void *ctx;
+} touch_hal_t;
+
+typedef struct {
+    float threshold;    /*!< active when raw - baseline > baseline * threshold */
+    bool repeat;        /*!< see touch_gesture_add_pad */
+    bool double_tap;
+    bool guard;         /*!< guard ring: while active every other pad is ignored */
+} touch_proc_pad_t;
+
+typedef struct {
+    touch_hal_t hal;
+    touch_gesture_engine_t engine;
+    touch_proc_pad_t pads[TOUCH_PROC_MAX_PADS];
+    int pad_count;
+    int gesture_pad[TOUCH_PROC_MAX_PADS];   /*!< engine index, -1 for the guard */
+    bool active[TOUCH_PROC_MAX_PADS];
+    uint32_t baseline[TOUCH_PROC_MAX_PADS];
+    int active_count;
+    bool guard_active;
+    int64_t maintain_us;
+} touch_proc_t;
+
+void touch_proc_init(touch_proc_t *proc, const touch_hal_t *hal, const touch_gesture_config_t *config,
+                     const touch_proc_pad_t *pads, int count);
+
+/**
+ * @brief Read every baseline through the HAL and program the thresholds
+ */
+void touch_proc_calibrate(touch_proc_t *proc);
+
+/**
+ * @brief A pad went active or inactive (hardware threshold interrupt)
+ */
+void touch_proc_edge(touch_proc_t *proc, int pad, bool active, int64_t now_us);
+
+/**
+ * @brief Feed one raw reading, detection is done in software against a
+ *        baseline that follows the idle readings. For recorded traces.
+ */
+void touch_proc_sample(touch_proc_t *proc, int pad, uint32_t raw, int64_t now_us);
+
+/**
+ * @brief Run timed gestures and, while nothing is touched, threshold upkeep
+ *
+ * @return time of the next deadline, or 0 if no gesture is pending
+ */
+int64_t touch_proc_tick(touch_proc_t *proc, int64_t now_us);
+
+static inline bool touch_proc_idle(const touch_proc_t *proc)
+{
+    return proc->active_count == 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
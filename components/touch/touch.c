@@ -12,28 +12,53 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "driver/touch_pad.h"
+#include "xtensa/core-macros.h"
 #include "soc/rtc_periph.h"
 #include "soc/sens_periph.h"
 #include "board.h"
 #include "audio.h"
+#include "command_router.h"
+#include "touch.h"
+#include "touch_proc.h"
 
 static const char *TAG = "Touch pad";
 
-static QueueHandle_t que_touch = NULL;
 typedef struct touch_msg
 {
     touch_pad_intr_mask_t intr_mask;
     uint32_t pad_num;
     uint32_t pad_status;
     uint32_t pad_val;
+    int64_t timestamp_us;
+    uint32_t ccount; /*!< CPU cycle counter when the ISR ran */
 } touch_event_t;
 
+/*
+ * Single producer (ISR) / single consumer (read task) ring. The ISR fills
+ * the slot at head and then publishes it; the task only moves tail. A full
+ * ring drops the new event and counts it.
+ */
+#define TOUCH_RING_SIZE 64
+#define TOUCH_RING_MASK (TOUCH_RING_SIZE - 1)
+
+static touch_event_t touch_ring[TOUCH_RING_SIZE];
+static atomic_uint ring_head;
+static atomic_uint ring_tail;
+static TaskHandle_t touch_task_handle = NULL;
+
+#define TOUCH_CPU_MHZ CONFIG_ESP32S2_DEFAULT_CPU_FREQ_MHZ
+
+static touch_stats_t stats;
+
 static uint32_t pad_status;
 static uint32_t pad_num;
 static uint32_t pad_mask;
@@ -41,6 +66,7 @@ static uint32_t pad_flag;
 #define TOUCH_BUTTON_WATERPROOF_ENABLE 1
 #define TOUCH_BUTTON_DENOISE_ENABLE 1
 #define TOUCH_BUTTON_NUM 7
+#define TOUCH_GUARD_INDEX 6
 
 static const touch_pad_t button[TOUCH_BUTTON_NUM] = {
     TOUCH_BUTTON_PHOTO,   /*!< 'PHOTO' button */
@@ -69,25 +95,67 @@ static const float button_threshold[TOUCH_BUTTON_NUM] = {
     0.1,
 };
 
+/*!< What each gesture does on each button, NONE for nothing */
+typedef struct
+{
+    audio_command_t tap;
+    audio_command_t double_tap;
+    audio_command_t long_press;
+    bool repeat; /*!< tap on press, REPEAT sends `tap` again while held */
+} touch_action_t;
+
+static const touch_action_t button_action[TOUCH_BUTTON_NUM - 1] = {
+    {PREVIOUS_AUDIO, NONE, SEEK_AUDIO, false},        /*!< 'PHOTO': previous, hold restarts the track */
+    {PLAY_PAUSE_AUDIO, NEXT_AUDIO, STOP_AUDIO, false}, /*!< 'PLAY/PAUSE' */
+    {NEXT_AUDIO, NONE, NONE, false},                  /*!< 'NETWORK': next */
+    {STOP_AUDIO, NONE, NONE, false},                  /*!< 'RECORD': stop */
+    {VOL_UP_AUDIO, NONE, NONE, true},                 /*!< 'VOL_UP' */
+    {VOL_DOWN_AUDIO, NONE, NONE, true},               /*!< 'VOL_DOWN' */
+};
+
+static touch_proc_t touch_proc;
+/*!< ISR cycle count of the edge being processed, for gestures it triggers */
+static uint32_t edge_ccount;
+static bool edge_valid = false;
+
 /*
   Handle an interrupt triggered when a pad is touched.
   Recognize what pad has been touched and save it in a table.
  */
 static void touchsensor_interrupt_cb(void *arg)
 {
-    int task_awoken = pdFALSE;
-    touch_event_t evt;
-
-    evt.intr_mask = touch_pad_read_intr_status_mask();
-    evt.pad_status = touch_pad_get_status();
-    evt.pad_num = touch_pad_get_current_meas_channel();
+    BaseType_t task_awoken = pdFALSE;
+    uint32_t ccount = xthal_get_ccount();
+    unsigned head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+    touch_pad_intr_mask_t intr_mask = touch_pad_read_intr_status_mask();
 
-    if (evt.intr_mask & TOUCH_PAD_INTR_MASK_DONE)
+    if (head - tail == TOUCH_RING_SIZE)
     {
-        touch_pad_read_benchmark(evt.pad_num, &evt.pad_val);
+        stats.dropped++;
     }
+    else
+    {
+        touch_event_t *evt = &touch_ring[head & TOUCH_RING_MASK];
+        evt->ccount = ccount;
+        evt->intr_mask = intr_mask;
+        evt->pad_status = touch_pad_get_status();
+        evt->pad_num = touch_pad_get_current_meas_channel();
+        evt->timestamp_us = esp_timer_get_time();
+
+        if (intr_mask & TOUCH_PAD_INTR_MASK_DONE)
+        {
+            touch_pad_read_benchmark(evt->pad_num, &evt->pad_val);
+        }
 
-    xQueueSendFromISR(que_touch, &evt, &task_awoken);
+        atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+        stats.events++;
+    }
+
+    if (touch_task_handle != NULL)
+    {
+        vTaskNotifyGiveFromISR(touch_task_handle, &task_awoken);
+    }
 
     if (task_awoken == pdTRUE)
     {
@@ -95,18 +163,45 @@ static void touchsensor_interrupt_cb(void *arg)
     }
 }
 
-static void tp_example_set_thresholds(void)
+static bool touch_ring_pop(touch_event_t *evt)
 {
-    uint32_t touch_value;
+    unsigned tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&ring_head, memory_order_acquire);
 
-    for (int i = 0; i < TOUCH_BUTTON_NUM; i++)
+    if (head == tail)
+    {
+        return false;
+    }
+
+    if (head - tail > stats.max_depth)
     {
-        /*!< read baseline value */
-        touch_pad_read_benchmark(button[i], &touch_value);
-        /*!< set interrupt threshold. */
-        touch_pad_set_thresh(button[i], touch_value * button_threshold[i]);
-        // ESP_LOGI(TAG, "test init: touch pad [%d] base %d, thresh %d", \       button[i], touch_value, (uint32_t)(touch_value * button_threshold[i]));
+        stats.max_depth = head - tail;
     }
+
+    *evt = touch_ring[tail & TOUCH_RING_MASK];
+    atomic_store_explicit(&ring_tail, tail + 1, memory_order_release);
+    return true;
+}
+
+/*!< Bucket i counts latencies in [2^i, 2^(i+1)) us, bucket 0 also takes < 1 us */
+static void touch_latency_record(uint32_t *histogram, uint32_t cycles)
+{
+    uint32_t us = cycles / TOUCH_CPU_MHZ;
+    int bucket = 0;
+
+    while (us > 1 && bucket < TOUCH_LATENCY_BUCKETS - 1)
+    {
+        us >>= 1;
+        bucket++;
+    }
+
+    histogram[bucket]++;
+}
+
+void touch_get_stats(touch_stats_t *out)
+{
+    /*!< counters are single-writer words, a snapshot may be a few events stale */
+    memcpy(out, &stats, sizeof(*out));
 }
 
 static void touchsensor_filter_set(touch_filter_mode_t mode)
@@ -124,119 +219,164 @@ static void touchsensor_filter_set(touch_filter_mode_t mode)
     // ESP_LOGI(TAG, "touch pad filter init %d", mode);
 }
 
+static int tp_button_index(uint32_t pad_num)
+{
+    for (int i = 0; i < TOUCH_BUTTON_NUM; i++)
+    {
+        if (button[i] == pad_num)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static uint32_t tp_hal_read_baseline(void *ctx, int pad)
+{
+    uint32_t touch_value = 0;
+    touch_pad_read_benchmark(button[pad], &touch_value);
+    return touch_value;
+}
+
+static void tp_hal_set_threshold(void *ctx, int pad, uint32_t threshold)
+{
+    touch_pad_set_thresh(button[pad], threshold);
+}
+
+/*!< One command per recognised gesture */
+static void tp_gesture_cb(void *ctx, int pad, touch_gesture_t gesture)
+{
+    const touch_action_t *action = &button_action[pad];
+    audio_command_t command = NONE;
+
+    switch (gesture)
+    {
+    case TOUCH_GESTURE_TAP:
+    case TOUCH_GESTURE_REPEAT:
+        command = action->tap;
+        break;
+    case TOUCH_GESTURE_DOUBLE_TAP:
+        command = action->double_tap;
+        break;
+    case TOUCH_GESTURE_LONG_PRESS:
+        command = action->long_press;
+        break;
+    }
+
+    if (command == NONE)
+    {
+        return;
+    }
+
+    ESP_LOGD(TAG, "pad [%d] gesture %d", button[pad], gesture);
+    /*!< SEEK_AUDIO from a pad always means back to the start of the track */
+    audio_action_t audio_action = {.command = command, .value = 0};
+    command_route(COMMAND_SOURCE_TOUCH, &audio_action, 1);
+
+    if (edge_valid)
+    {
+        touch_latency_record(stats.command_us, xthal_get_ccount() - edge_ccount);
+    }
+}
+
 static void tp_example_read_task(void *pvParameter)
 {
     touch_event_t evt = {0};
-    static uint8_t guard_mode_flag = 0;
+    int64_t deadline_us = 0;
+    const touch_hal_t hal = {
+        .read_baseline = tp_hal_read_baseline,
+        .set_threshold = tp_hal_set_threshold,
+        .gesture = tp_gesture_cb,
+    };
+    touch_proc_pad_t pads[TOUCH_BUTTON_NUM];
+    touch_gesture_config_t config = TOUCH_GESTURE_DEFAULT_CONFIG();
+
+    for (int i = 0; i < TOUCH_BUTTON_NUM; i++)
+    {
+        pads[i].threshold = button_threshold[i];
+        pads[i].guard = i == TOUCH_GUARD_INDEX;
+        pads[i].repeat = !pads[i].guard && button_action[i].repeat;
+        pads[i].double_tap = !pads[i].guard && button_action[i].double_tap != NONE;
+    }
+
+    touch_proc_init(&touch_proc, &hal, &config, pads, TOUCH_BUTTON_NUM);
     /*!< Wait touch sensor init done */
     vTaskDelay(100 / portTICK_RATE_MS);
-    tp_example_set_thresholds();
+    touch_proc_calibrate(&touch_proc);
 
     while (1)
     {
-        int ret = xQueueReceive(que_touch, &evt, (portTickType)portMAX_DELAY);
+        TickType_t wait = portMAX_DELAY;
+        int64_t now_us = esp_timer_get_time();
 
-        if (ret != pdTRUE)
+        if (deadline_us != 0)
+        {
+            wait = deadline_us > now_us ? (deadline_us - now_us) / 1000 / portTICK_RATE_MS + 1 : 0;
+        }
+        if (touch_proc_idle(&touch_proc) && wait > TOUCH_PROC_MAINTAIN_US / 1000 / portTICK_RATE_MS)
         {
+            wait = TOUCH_PROC_MAINTAIN_US / 1000 / portTICK_RATE_MS;
+        }
+
+        bool ret = touch_ring_pop(&evt);
+        if (!ret)
+        {
+            ulTaskNotifyTake(pdTRUE, wait);
+            ret = touch_ring_pop(&evt);
+        }
+        now_us = esp_timer_get_time();
+
+        if (!ret)
+        {
+            deadline_us = touch_proc_tick(&touch_proc, now_us);
             continue;
         }
 
+        touch_latency_record(stats.dispatch_us, xthal_get_ccount() - evt.ccount);
+        edge_ccount = evt.ccount;
+        edge_valid = true;
+
+        int index = tp_button_index(evt.pad_num);
+
         if (evt.intr_mask & TOUCH_PAD_INTR_MASK_ACTIVE)
         {
-            /*!< if guard pad be touched, other pads no response. */
-            if (evt.pad_num == button[6])
+            if (index == TOUCH_GUARD_INDEX)
             {
-                guard_mode_flag = 1;
                 ESP_LOGW(TAG, "TouchSensor [%d] be actived, enter guard mode", evt.pad_num);
             }
+            else if (touch_proc.guard_active)
+            {
+                ESP_LOGW(TAG, "In guard mode. No response");
+            }
             else
             {
-                if (guard_mode_flag == 0)
-                {
-                    // ESP_LOGI(TAG, "TouchSensor [%d] be actived, status mask 0x%x", evt.pad_num, evt.pad_status);
-                    pad_status = evt.pad_status;
-                    pad_num = evt.pad_num;
-                    pad_mask = evt.intr_mask;
-                    pad_flag = true;
-                    switch (pad_num)
-                    {
-                    case TOUCH_BUTTON_VOLUP:
-                    {
-                        send_command(VOL_UP_AUDIO);
-                    }
-                    break;
-
-                    case TOUCH_BUTTON_VOLDOWN:
-                    {
-                        send_command(VOL_DOWN_AUDIO);
-                    }
-                    break;
-
-                    case TOUCH_BUTTON_PLAY:
-                    {
-                        send_command(PLAY_PAUSE_AUDIO);
-                    }
-                    break;
-
-                    // Pista anterior
-                    case TOUCH_BUTTON_PHOTO:
-                    {
-                        send_command(PREVIOUS_AUDIO);
-                    }
-                    break;
-
-                    // Pista siguiente
-                    case TOUCH_BUTTON_NETWORK:
-                    {
-                        send_command(NEXT_AUDIO);
-                    }
-                    break;
-
-                    case TOUCH_BUTTON_RECORD:
-                    {
-                        send_command(STOP_AUDIO);
-                    }
-                    break;
-
-                    default:
-                    {
-                        ESP_LOGW(TAG, "Unable to process button touch for media control");
-                    }
-                    break;
-                    }
-                }
-                else
-                {
-                    ESP_LOGW(TAG, "In guard mode. No response");
-                }
+                pad_status = evt.pad_status;
+                pad_num = evt.pad_num;
+                pad_mask = evt.intr_mask;
+                pad_flag = true;
             }
+            touch_proc_edge(&touch_proc, index, true, evt.timestamp_us);
         }
 
         if (evt.intr_mask & TOUCH_PAD_INTR_MASK_INACTIVE)
         {
-            /*!< if guard pad be touched, other pads no response. */
-            if (evt.pad_num == button[6])
-            {
-                guard_mode_flag = 0;
-                // ESP_LOGW(TAG, "TouchSensor [%d] be actived, exit guard mode", evt.pad_num);
-            }
-            else
+            if (index != TOUCH_GUARD_INDEX && !touch_proc.guard_active)
             {
-                if (guard_mode_flag == 0)
-                {
-                    // ESP_LOGI(TAG, "TouchSensor [%d] be inactived, status mask 0x%x", evt.pad_num, evt.pad_status);
-                    pad_status = evt.pad_status;
-                    pad_num = evt.pad_num;
-                    pad_mask = evt.intr_mask;
-                    pad_flag = false;
-                }
+                pad_status = evt.pad_status;
+                pad_num = evt.pad_num;
+                pad_mask = evt.intr_mask;
+                pad_flag = false;
             }
+            touch_proc_edge(&touch_proc, index, false, evt.timestamp_us);
         }
 
         if (evt.intr_mask & TOUCH_PAD_INTR_MASK_DONE)
         {
             ESP_LOGI(TAG, "TouchSensor [%d] measure done, raw data %d", evt.pad_num, evt.pad_val);
         }
+
+        edge_valid = false;
+        deadline_us = touch_proc_tick(&touch_proc, now_us);
     }
 }
 
@@ -262,10 +402,8 @@ void touch_get_mask(uint32_t *mask)
 
 void touch_init()
 {
-    if (que_touch == NULL)
-    {
-        que_touch = xQueueCreate(TOUCH_BUTTON_NUM, sizeof(touch_event_t));
-    }
+    /*!< The read task must exist before the ISR can notify it */
+    xTaskCreate(&tp_example_read_task, "touch_pad_read_task", 2048, NULL, 5, &touch_task_handle);
 
     /*!< Initialize touch pad peripheral, it will start a timer to run a filter */
     ESP_LOGI(TAG, "Initializing touch pad");
@@ -324,7 +462,4 @@ void touch_init()
     /*!< Enable touch sensor clock. Work mode is "timer trigger". */
     touch_pad_set_fsm_mode(TOUCH_FSM_MODE_TIMER);
     touch_pad_fsm_start();
-
-    /*!< Start a task to show what pads have been touched */
-    xTaskCreate(&tp_example_read_task, "touch_pad_read_task", 2048, NULL, 5, NULL);
 }
@@ -0,0 +1,150 @@
+#include <string.h>
+#include "touch_gesture.h"
+
+/*
+ * Gesture recognition on press / release timestamps. Nothing in here talks
+ * to the touch peripheral, the caller feeds it edges and calls
+ * touch_gesture_tick() when the returned deadline expires.
+ */
+
+void touch_gesture_init(touch_gesture_engine_t *engine, const touch_gesture_config_t *config,
+                        touch_gesture_cb_t cb, void *arg)
+{
+    memset(engine, 0, sizeof(*engine));
+    engine->config = *config;
+    engine->cb = cb;
+    engine->arg = arg;
+}
+
+int touch_gesture_add_pad(touch_gesture_engine_t *engine, bool repeat, bool double_tap)
+{
+    if (engine->pad_count == TOUCH_GESTURE_MAX_PADS) {
+        return -1;
+    }
+
+    touch_gesture_pad_t *p = &engine->pads[engine->pad_count];
+    memset(p, 0, sizeof(*p));
+    p->repeat = repeat;
+    p->double_tap = double_tap && !repeat;
+    return engine->pad_count++;
+}
+
+static void emit(touch_gesture_engine_t *engine, int pad, touch_gesture_t gesture)
+{
+    if (engine->cb) {
+        engine->cb(pad, gesture, engine->arg);
+    }
+}
+
+void touch_gesture_press(touch_gesture_engine_t *engine, int pad, int64_t now_us)
+{
+    if (pad < 0 || pad >= engine->pad_count) {
+        return;
+    }
+
+    touch_gesture_pad_t *p = &engine->pads[pad];
+
+    if (p->pressed || (p->release_us != 0 && now_us - p->release_us < engine->config.debounce_us)) {
+        return;
+    }
+
+    p->pressed = true;
+    p->long_fired = false;
+    p->press_us = now_us;
+
+    if (p->repeat) {
+        emit(engine, pad, TOUCH_GESTURE_TAP);
+        p->next_us = now_us + engine->config.repeat_delay_us;
+    } else {
+        /*!< a pending tap followed by this press is resolved on release */
+        p->next_us = now_us + engine->config.long_press_us;
+    }
+}
+
+void touch_gesture_release(touch_gesture_engine_t *engine, int pad, int64_t now_us)
+{
+    if (pad < 0 || pad >= engine->pad_count) {
+        return;
+    }
+
+    touch_gesture_pad_t *p = &engine->pads[pad];
+
+    if (!p->pressed) {
+        return;
+    }
+
+    p->pressed = false;
+    p->release_us = now_us;
+    p->next_us = 0;
+
+    if (p->repeat || p->long_fired) {
+        p->tap_pending = false;
+        return;
+    }
+
+    if (now_us - p->press_us < engine->config.min_press_us) {
+        /*!< glitch: drop it, but keep a tap already waiting for its pair */
+        if (p->tap_pending) {
+            p->next_us = p->tap_us + engine->config.double_tap_us;
+        }
+        return;
+    }
+
+    if (!p->double_tap) {
+        emit(engine, pad, TOUCH_GESTURE_TAP);
+    } else if (p->tap_pending) {
+        p->tap_pending = false;
+        emit(engine, pad, TOUCH_GESTURE_DOUBLE_TAP);
+    } else {
+        p->tap_pending = true;
+        p->tap_us = now_us;
+        p->next_us = now_us + engine->config.double_tap_us;
+    }
+}
+
+int64_t touch_gesture_tick(touch_gesture_engine_t *engine, int64_t now_us)
+{
+    int64_t next = 0;
+
+    for (int pad = 0; pad < engine->pad_count; pad++) {
+        touch_gesture_pad_t *p = &engine->pads[pad];
+
+        if (p->next_us != 0 && now_us >= p->next_us) {
+            if (p->pressed && p->repeat) {
+                emit(engine, pad, TOUCH_GESTURE_REPEAT);
+                p->next_us += engine->config.repeat_period_us;
+                if (p->next_us <= now_us) {
+                    p->next_us = now_us + engine->config.repeat_period_us;
+                }
+            } else if (p->pressed) {
+                p->long_fired = true;
+                p->tap_pending = false;
+                p->next_us = 0;
+                emit(engine, pad, TOUCH_GESTURE_LONG_PRESS);
+            } else if (p->tap_pending) {
+                p->tap_pending = false;
+                p->next_us = 0;
+                emit(engine, pad, TOUCH_GESTURE_TAP);
+            } else {
+                p->next_us = 0;
+            }
+        }
+
+        if (p->next_us != 0 && (next == 0 || p->next_us < next)) {
+            next = p->next_us;
+        }
+    }
+
+    return next;
+}
+
+void touch_gesture_cancel(touch_gesture_engine_t *engine)
+{
+    for (int pad = 0; pad < engine->pad_count; pad++) {
+        touch_gesture_pad_t *p = &engine->pads[pad];
+        p->pressed = false;
+        p->long_fired = false;
+        p->tap_pending = false;
+        p->next_us = 0;
+    }
+}
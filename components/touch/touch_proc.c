@@ -0,0 +1,119 @@
+#include <string.h>
+#include "touch_proc.h"
+
+static void touch_proc_gesture_cb(int gesture_pad, touch_gesture_t gesture, void *arg)
+{
+    touch_proc_t *proc = arg;
+
+    for (int pad = 0; pad < proc->pad_count; pad++) {
+        if (proc->gesture_pad[pad] == gesture_pad) {
+            proc->hal.gesture(proc->hal.ctx, pad, gesture);
+            return;
+        }
+    }
+}
+
+void touch_proc_init(touch_proc_t *proc, const touch_hal_t *hal, const touch_gesture_config_t *config,
+                     const touch_proc_pad_t *pads, int count)
+{
+    memset(proc, 0, sizeof(*proc));
+    proc->hal = *hal;
+    proc->pad_count = count > TOUCH_PROC_MAX_PADS ? TOUCH_PROC_MAX_PADS : count;
+    memcpy(proc->pads, pads, proc->pad_count * sizeof(touch_proc_pad_t));
+
+    touch_gesture_init(&proc->engine, config, touch_proc_gesture_cb, proc);
+    for (int pad = 0; pad < proc->pad_count; pad++) {
+        proc->gesture_pad[pad] = pads[pad].guard ? -1 : touch_gesture_add_pad(&proc->engine, pads[pad].repeat, pads[pad].double_tap);
+    }
+}
+
+static uint32_t touch_proc_threshold(const touch_proc_t *proc, int pad)
+{
+    return proc->baseline[pad] * proc->pads[pad].threshold;
+}
+
+void touch_proc_calibrate(touch_proc_t *proc)
+{
+    for (int pad = 0; pad < proc->pad_count; pad++) {
+        proc->baseline[pad] = proc->hal.read_baseline(proc->hal.ctx, pad);
+        proc->hal.set_threshold(proc->hal.ctx, pad, touch_proc_threshold(proc, pad));
+    }
+}
+
+void touch_proc_edge(touch_proc_t *proc, int pad, bool active, int64_t now_us)
+{
+    if (pad < 0 || pad >= proc->pad_count || proc->active[pad] == active) {
+        return;
+    }
+
+    proc->active[pad] = active;
+    proc->active_count += active ? 1 : -1;
+
+    if (proc->pads[pad].guard) {
+        proc->guard_active = active;
+        if (active) {
+            touch_gesture_cancel(&proc->engine);
+        }
+        return;
+    }
+
+    if (active && !proc->guard_active) {
+        touch_gesture_press(&proc->engine, proc->gesture_pad[pad], now_us);
+    } else if (!active) {
+        /*!< a press cancelled by the guard ring ignores its release */
+        touch_gesture_release(&proc->engine, proc->gesture_pad[pad], now_us);
+    }
+}
+
+void touch_proc_sample(touch_proc_t *proc, int pad, uint32_t raw, int64_t now_us)
+{
+    if (pad < 0 || pad >= proc->pad_count) {
+        return;
+    }
+
+    if (proc->baseline[pad] == 0) {
+        proc->baseline[pad] = raw;
+    }
+
+    uint32_t threshold = touch_proc_threshold(proc, pad);
+    int64_t delta = (int64_t)raw - proc->baseline[pad];
+
+    if (!proc->active[pad]) {
+        if (delta > threshold) {
+            touch_proc_edge(proc, pad, true, now_us);
+        } else {
+            /*!< only idle readings move the baseline, like the hardware filter */
+            proc->baseline[pad] += ((int64_t)raw - proc->baseline[pad]) >> TOUCH_PROC_BASELINE_SHIFT;
+        }
+    } else if (delta * 100 < (int64_t)threshold * TOUCH_PROC_HYSTERESIS_PCT) {
+        touch_proc_edge(proc, pad, false, now_us);
+    }
+}
+
+/*
+ * The hardware baseline follows slow drift (temperature, humidity) but the
+ * interrupt threshold is an absolute value, re-derive it when the baseline
+ * has moved.
+ */
+static void touch_proc_maintain(touch_proc_t *proc)
+{
+    for (int pad = 0; pad < proc->pad_count; pad++) {
+        uint32_t value = proc->hal.read_baseline(proc->hal.ctx, pad);
+        uint32_t drift = value > proc->baseline[pad] ? value - proc->baseline[pad] : proc->baseline[pad] - value;
+
+        if (drift * 100 > proc->baseline[pad] * TOUCH_PROC_DRIFT_PCT) {
+            proc->baseline[pad] = value;
+            proc->hal.set_threshold(proc->hal.ctx, pad, touch_proc_threshold(proc, pad));
+        }
+    }
+}
+
+int64_t touch_proc_tick(touch_proc_t *proc, int64_t now_us)
+{
+    if (touch_proc_idle(proc) && now_us - proc->maintain_us >= TOUCH_PROC_MAINTAIN_US) {
+        proc->maintain_us = now_us;
+        touch_proc_maintain(proc);
+    }
+
+    return touch_gesture_tick(&proc->engine, now_us);
+}
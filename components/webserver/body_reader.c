@@ -0,0 +1,140 @@
+#include <string.h>
+#include "body_reader.h"
+#include "esp_log.h"
+
+static const char *TAG = "body_reader";
+
+esp_err_t body_read_json(httpd_req_t *req, json_stream_t *stream)
+{
+    char chunk[BODY_CHUNK_LEN];
+    size_t remaining = req->content_len;
+
+    while (remaining > 0)
+    {
+        int ret = httpd_req_recv(req, chunk, remaining < sizeof(chunk) ? remaining : sizeof(chunk));
+        if (ret <= 0)
+        {
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+            {
+                httpd_resp_send_408(req);
+            }
+            return ESP_FAIL;
+        }
+        remaining -= ret;
+
+        esp_err_t err = json_stream_feed(stream, chunk, ret);
+        if (err != ESP_OK)
+        {
+            ESP_LOGW(TAG, "Body rejected after %d of %d bytes (%s)",
+                     (int)(req->content_len - remaining), (int)req->content_len, esp_err_to_name(err));
+            return err;
+        }
+    }
+
+    return json_stream_finish(stream);
+}
+
+static const char *body_store(body_fields_t *body, const char *text, size_t len)
+{
+    if (body->used + len + 1 > sizeof(body->arena))
+    {
+        body->error = "Body too large";
+        return NULL;
+    }
+
+    char *copy = body->arena + body->used;
+    memcpy(copy, text, len + 1);
+    body->used += len + 1;
+    return copy;
+}
+
+static bool body_fields_cb(json_stream_event_t event, const char *text, size_t len, int depth, void *arg)
+{
+    body_fields_t *body = arg;
+
+    if (depth == 0)
+    {
+        if (event == JSON_STREAM_OBJECT_START || event == JSON_STREAM_OBJECT_END)
+        {
+            return true;
+        }
+        body->error = "Expected a JSON object";
+        return false;
+    }
+
+    switch (event)
+    {
+    case JSON_STREAM_KEY:
+        body->key = body_store(body, text, len);
+        return body->key != NULL;
+    case JSON_STREAM_STRING:
+    case JSON_STREAM_NUMBER:
+    case JSON_STREAM_TRUE:
+    case JSON_STREAM_FALSE:
+    case JSON_STREAM_NULL:
+        break;
+    default:
+        body->error = "Nested values not supported";
+        return false;
+    }
+
+    if (body->count == BODY_FIELDS_MAX)
+    {
+        body->error = "Too many fields";
+        return false;
+    }
+
+    body_field_t *field = &body->fields[body->count];
+    field->key = body->key;
+    field->type = event;
+    field->value = NULL;
+    if (event != JSON_STREAM_NULL)
+    {
+        field->value = body_store(body, text, len);
+        if (field->value == NULL)
+        {
+            return false;
+        }
+    }
+    body->count++;
+    return true;
+}
+
+esp_err_t body_read_fields(httpd_req_t *req, body_fields_t *body)
+{
+    body->used = 0;
+    body->count = 0;
+    body->key = NULL;
+    body->error = NULL;
+    json_stream_init(&body->stream, body_fields_cb, body);
+
+    return body_read_json(req, &body->stream);
+}
+
+const body_field_t *body_find(const body_fields_t *body, const char *key)
+{
+    // Last one wins for repeated keys, like most JSON parsers
+    for (size_t i = body->count; i > 0; i--)
+    {
+        if (strcmp(body->fields[i - 1].key, key) == 0)
+        {
+            return &body->fields[i - 1];
+        }
+    }
+    return NULL;
+}
+
+const char *body_get_string(const body_fields_t *body, const char *key)
+{
+    const body_field_t *field = body_find(body, key);
+    return field != NULL && field->type == JSON_STREAM_STRING ? field->value : NULL;
+}
+
+const char *body_error_message(const body_fields_t *body, esp_err_t err)
+{
+    if (err == ESP_ERR_INVALID_STATE && body->error != NULL)
+    {
+        return body->error;
+    }
+    return err == ESP_ERR_INVALID_SIZE ? "Value too long" : "Invalid JSON";
+}
@@ -0,0 +1,17 @@
+#!/usr/bin/env python
+#
+# Gzip a static asset for embedding in the firmware.
+# mtime is pinned to 0 so the output (and its ETag) only changes with the input.
+#
+import gzip
+import sys
+
+if len(sys.argv) != 3:
+    sys.exit('usage: compress_asset.py <input> <output>')
+
+with open(sys.argv[1], 'rb') as src:
+    data = src.read()
+
+with open(sys.argv[2], 'wb') as dst:
+    with gzip.GzipFile(filename='', mode='wb', compresslevel=9, fileobj=dst, mtime=0) as gz:
+        gz.write(data)
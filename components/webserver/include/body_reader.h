@@ -0,0 +1,60 @@
+#ifndef BODY_READER_H
+#define BODY_READER_H
+
+#include <stddef.h>
+#include <esp_http_server.h>
+#include "json_stream.h"
+
+/*
+ * Request bodies are read in BODY_CHUNK_LEN pieces and pushed straight into
+ * a json_stream_t, so they can be any length and are never held whole. For
+ * the common flat object case the scalars are kept in a bounded arena.
+ */
+
+#define BODY_CHUNK_LEN 128
+#define BODY_ARENA_LEN 1024
+#define BODY_FIELDS_MAX 32
+
+typedef struct
+{
+    const char *key;
+    const char *value;        /*!< scalar text, "true" / "false" for booleans, NULL for null */
+    json_stream_event_t type; /*!< JSON_STREAM_STRING, _NUMBER, _TRUE, _FALSE or _NULL */
+} body_field_t;
+
+typedef struct
+{
+    json_stream_t stream;
+    char arena[BODY_ARENA_LEN]; /*!< keys and values, back to back */
+    size_t used;
+    body_field_t fields[BODY_FIELDS_MAX];
+    size_t count;
+    const char *key;
+    const char *error; /*!< why the callback stopped the parse */
+} body_fields_t;
+
+/**
+ * @brief Feed the whole body of `req` through `stream`, which the caller has
+ *        set up with json_stream_init(), and finish it.
+ *
+ * @return - ESP_OK if the body is one complete JSON value
+ *         - ESP_FAIL on a socket error, a 408 has been sent for timeouts
+ *         - any json_stream_feed() / json_stream_finish() error
+ */
+esp_err_t body_read_json(httpd_req_t *req, json_stream_t *stream);
+
+/**
+ * @brief Read a flat JSON object body into `body->fields`. Nested objects and
+ *        arrays are refused. Same return values as body_read_json().
+ */
+esp_err_t body_read_fields(httpd_req_t *req, body_fields_t *body);
+
+/*!< Value of `key` if present and a JSON string, NULL otherwise */
+const char *body_get_string(const body_fields_t *body, const char *key);
+
+const body_field_t *body_find(const body_fields_t *body, const char *key);
+
+/*!< Short reason for a 400 response after a failed body_read_fields() */
+const char *body_error_message(const body_fields_t *body, esp_err_t err);
+
+#endif // BODY_READER_H
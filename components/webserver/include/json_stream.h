@@ -0,0 +1,69 @@
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/*
+ * Push tokenizer for JSON arriving in pieces. Feed it whatever was received
+ * and it reports keys, scalars and container bounds through a callback; no
+ * tree is built and memory use is the fixed size of json_stream_t whatever
+ * the document length. Strings are unescaped, numbers passed as their text.
+ */
+
+#define JSON_STREAM_TOKEN_MAX 256 /*!< longest key, string or number accepted */
+#define JSON_STREAM_DEPTH_MAX 16
+
+typedef enum
+{
+    JSON_STREAM_OBJECT_START,
+    JSON_STREAM_OBJECT_END,
+    JSON_STREAM_ARRAY_START,
+    JSON_STREAM_ARRAY_END,
+    JSON_STREAM_KEY,
+    JSON_STREAM_STRING,
+    JSON_STREAM_NUMBER,
+    JSON_STREAM_TRUE,
+    JSON_STREAM_FALSE,
+    JSON_STREAM_NULL,
+} json_stream_event_t;
+
+/**
+ * @brief Called once per token. `text` is NUL terminated and only valid for
+ *        the call; `depth` is the nesting level the token lives in, 1 for
+ *        the members of the top-level object.
+ *
+ * @return false to stop parsing, json_stream_feed() then fails with ESP_ERR_INVALID_STATE
+ */
+typedef bool (*json_stream_cb_t)(json_stream_event_t event, const char *text, size_t len, int depth, void *arg);
+
+typedef struct
+{
+    uint8_t state;
+    bool is_key;
+    int depth;
+    uint32_t containers; /*!< bit per level, set for objects */
+    uint8_t unicode_digits;
+    uint16_t unicode;
+    size_t len;
+    char token[JSON_STREAM_TOKEN_MAX + 1];
+    json_stream_cb_t cb;
+    void *arg;
+} json_stream_t;
+
+void json_stream_init(json_stream_t *stream, json_stream_cb_t cb, void *arg);
+
+/**
+ * @return - ESP_OK if the input so far is valid
+ *         - ESP_ERR_INVALID_ARG on a syntax error
+ *         - ESP_ERR_INVALID_SIZE if a token or the nesting is too large
+ *         - ESP_ERR_INVALID_STATE if the callback stopped the parse
+ */
+esp_err_t json_stream_feed(json_stream_t *stream, const char *data, size_t len);
+
+/*!< Call after the last piece, fails unless exactly one complete value was fed */
+esp_err_t json_stream_finish(json_stream_t *stream);
+
+#endif // JSON_STREAM_H
@@ -0,0 +1,367 @@
+#include <stdlib.h>
+#include <string.h>
+#include "json_stream.h"
+
+enum
+{
+    JS_VALUE,
+    JS_VALUE_OR_END, /*!< right after '[' */
+    JS_KEY,
+    JS_KEY_OR_END, /*!< right after '{' */
+    JS_COLON,
+    JS_AFTER_VALUE,
+    JS_STRING,
+    JS_ESCAPE,
+    JS_UNICODE,
+    JS_NUMBER,
+    JS_LITERAL,
+    JS_DONE,
+    JS_ERROR,
+};
+
+static bool is_ws(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool in_object(const json_stream_t *s)
+{
+    return (s->containers >> (s->depth - 1)) & 1;
+}
+
+static uint8_t after_value(const json_stream_t *s)
+{
+    return s->depth == 0 ? JS_DONE : JS_AFTER_VALUE;
+}
+
+static esp_err_t emit(json_stream_t *s, json_stream_event_t event)
+{
+    s->token[s->len] = '\0';
+    return s->cb(event, s->token, s->len, s->depth, s->arg) ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+static esp_err_t append(json_stream_t *s, char c)
+{
+    if (s->len == JSON_STREAM_TOKEN_MAX)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    s->token[s->len++] = c;
+    return ESP_OK;
+}
+
+static esp_err_t open_container(json_stream_t *s, bool object)
+{
+    if (s->depth == JSON_STREAM_DEPTH_MAX)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    s->len = 0;
+    esp_err_t err = emit(s, object ? JSON_STREAM_OBJECT_START : JSON_STREAM_ARRAY_START);
+    s->containers = object ? s->containers | (1u << s->depth) : s->containers & ~(1u << s->depth);
+    s->depth++;
+    s->state = object ? JS_KEY_OR_END : JS_VALUE_OR_END;
+    return err;
+}
+
+static esp_err_t close_container(json_stream_t *s, char c)
+{
+    bool object = c == '}';
+    if (s->depth == 0 || in_object(s) != object)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    s->depth--;
+    s->len = 0;
+    s->state = after_value(s);
+    return emit(s, object ? JSON_STREAM_OBJECT_END : JSON_STREAM_ARRAY_END);
+}
+
+/*!< Code point from \uXXXX as UTF-8, surrogate halves are passed through as-is */
+static esp_err_t append_unicode(json_stream_t *s, uint16_t cp)
+{
+    esp_err_t err;
+
+    if (cp < 0x80)
+    {
+        return append(s, cp);
+    }
+    if (cp < 0x800)
+    {
+        err = append(s, 0xC0 | (cp >> 6));
+        return err != ESP_OK ? err : append(s, 0x80 | (cp & 0x3F));
+    }
+    err = append(s, 0xE0 | (cp >> 12));
+    err = err != ESP_OK ? err : append(s, 0x80 | ((cp >> 6) & 0x3F));
+    return err != ESP_OK ? err : append(s, 0x80 | (cp & 0x3F));
+}
+
+static esp_err_t end_number(json_stream_t *s)
+{
+    char *end;
+
+    s->token[s->len] = '\0';
+    strtod(s->token, &end);
+    // strtod also takes hex, inf and leading '+', JSON doesn't
+    if (end != s->token + s->len || s->token[0] == '+' || strpbrk(s->token, "xXnN") != NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    s->state = after_value(s);
+    return emit(s, JSON_STREAM_NUMBER);
+}
+
+static esp_err_t end_literal(json_stream_t *s)
+{
+    json_stream_event_t event;
+
+    s->token[s->len] = '\0';
+    if (strcmp(s->token, "true") == 0)
+    {
+        event = JSON_STREAM_TRUE;
+    }
+    else if (strcmp(s->token, "false") == 0)
+    {
+        event = JSON_STREAM_FALSE;
+    }
+    else if (strcmp(s->token, "null") == 0)
+    {
+        event = JSON_STREAM_NULL;
+    }
+    else
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    s->state = after_value(s);
+    return emit(s, event);
+}
+
+static esp_err_t start_value(json_stream_t *s, char c)
+{
+    s->len = 0;
+
+    if (c == '{' || c == '[')
+    {
+        return open_container(s, c == '{');
+    }
+    if (c == '"')
+    {
+        s->is_key = false;
+        s->state = JS_STRING;
+        return ESP_OK;
+    }
+    if (c == '-' || (c >= '0' && c <= '9'))
+    {
+        s->state = JS_NUMBER;
+        return append(s, c);
+    }
+    if (c == 't' || c == 'f' || c == 'n')
+    {
+        s->state = JS_LITERAL;
+        return append(s, c);
+    }
+    return ESP_ERR_INVALID_ARG;
+}
+
+static esp_err_t step(json_stream_t *s, char c)
+{
+    switch (s->state)
+    {
+    case JS_VALUE_OR_END:
+        if (c == ']')
+        {
+            return close_container(s, c);
+        }
+        /* fall through */
+    case JS_VALUE:
+        return is_ws(c) ? ESP_OK : start_value(s, c);
+
+    case JS_KEY_OR_END:
+        if (c == '}')
+        {
+            return close_container(s, c);
+        }
+        /* fall through */
+    case JS_KEY:
+        if (is_ws(c))
+        {
+            return ESP_OK;
+        }
+        if (c != '"')
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        s->len = 0;
+        s->is_key = true;
+        s->state = JS_STRING;
+        return ESP_OK;
+
+    case JS_COLON:
+        if (is_ws(c))
+        {
+            return ESP_OK;
+        }
+        if (c != ':')
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        s->state = JS_VALUE;
+        return ESP_OK;
+
+    case JS_AFTER_VALUE:
+        if (is_ws(c))
+        {
+            return ESP_OK;
+        }
+        if (c == ',')
+        {
+            s->state = in_object(s) ? JS_KEY : JS_VALUE;
+            return ESP_OK;
+        }
+        if (c == '}' || c == ']')
+        {
+            return close_container(s, c);
+        }
+        return ESP_ERR_INVALID_ARG;
+
+    case JS_STRING:
+        if (c == '"')
+        {
+            s->state = s->is_key ? JS_COLON : after_value(s);
+            return emit(s, s->is_key ? JSON_STREAM_KEY : JSON_STREAM_STRING);
+        }
+        if (c == '\\')
+        {
+            s->state = JS_ESCAPE;
+            return ESP_OK;
+        }
+        if ((unsigned char)c < 0x20)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        return append(s, c);
+
+    case JS_ESCAPE:
+    {
+        static const char from[] = "\"\\/bfnrt";
+        static const char to[] = "\"\\/\b\f\n\r\t";
+        const char *found = c != '\0' ? strchr(from, c) : NULL;
+
+        if (c == 'u')
+        {
+            s->unicode = 0;
+            s->unicode_digits = 0;
+            s->state = JS_UNICODE;
+            return ESP_OK;
+        }
+        if (found == NULL)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        s->state = JS_STRING;
+        return append(s, to[found - from]);
+    }
+
+    case JS_UNICODE:
+    {
+        int digit = c >= '0' && c <= '9'   ? c - '0'
+                    : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                    : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                                           : -1;
+        if (digit < 0)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        s->unicode = (s->unicode << 4) | digit;
+        if (++s->unicode_digits < 4)
+        {
+            return ESP_OK;
+        }
+        s->state = JS_STRING;
+        return s->unicode == 0 ? ESP_ERR_INVALID_ARG : append_unicode(s, s->unicode);
+    }
+
+    case JS_NUMBER:
+        if ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-')
+        {
+            return append(s, c);
+        }
+        else
+        {
+            esp_err_t err = end_number(s);
+            return err != ESP_OK ? err : step(s, c);
+        }
+
+    case JS_LITERAL:
+        if (c >= 'a' && c <= 'z')
+        {
+            return append(s, c);
+        }
+        else
+        {
+            esp_err_t err = end_literal(s);
+            return err != ESP_OK ? err : step(s, c);
+        }
+
+    case JS_DONE:
+        return is_ws(c) ? ESP_OK : ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_ERR_INVALID_ARG;
+}
+
+void json_stream_init(json_stream_t *stream, json_stream_cb_t cb, void *arg)
+{
+    memset(stream, 0, sizeof(json_stream_t));
+    stream->state = JS_VALUE;
+    stream->cb = cb;
+    stream->arg = arg;
+}
+
+esp_err_t json_stream_feed(json_stream_t *stream, const char *data, size_t len)
+{
+    if (stream->state == JS_ERROR)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        esp_err_t err = step(stream, data[i]);
+        if (err != ESP_OK)
+        {
+            stream->state = JS_ERROR;
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t json_stream_finish(json_stream_t *stream)
+{
+    esp_err_t err = ESP_OK;
+
+    // A top-level scalar has nothing after it to end it
+    if (stream->state == JS_NUMBER)
+    {
+        err = end_number(stream);
+    }
+    else if (stream->state == JS_LITERAL)
+    {
+        err = end_literal(stream);
+    }
+
+    if (err == ESP_OK && stream->state != JS_DONE)
+    {
+        err = ESP_ERR_INVALID_ARG;
+    }
+    if (err != ESP_OK)
+    {
+        stream->state = JS_ERROR;
+    }
+    return err;
+}
@@ -1,6 +1,11 @@
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
 #include <esp_http_server.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
 #include "esp_event.h"
 #include "esp_system.h"
 #include "esp_log.h"
@@ -10,19 +15,150 @@
 #include "mqttclient.h"
 #include "config.h"
 #include "audio.h"
+#include "player_state.h"
+#include "command_router.h"
+#include "body_reader.h"
+#include "touch.h"
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define XSTR(x) #x
+#define STR(x) XSTR(x)
 
 #define TAG "webserver"
 
-static esp_err_t hello_get_handler(httpd_req_t *req)
+#if CONFIG_WEBSERVER_MAX_OPEN_SOCKETS > CONFIG_LWIP_MAX_SOCKETS - 3
+#error "WEBSERVER_MAX_OPEN_SOCKETS leaves lwIP too few sockets, httpd_start() would fail"
+#endif
+
+#define STATE_LONGPOLL_MAX_WAITERS 4
+#define STATE_LONGPOLL_MAX_WAIT_S 60
+#define STATE_JSON_MAX_LEN 160
+
+typedef struct
 {
-    extern const uint8_t foo_html_start[] asm("_binary_foo_html_start");
-    extern const uint8_t foo_html_end[] asm("_binary_foo_html_end");
-    const size_t foo_html_size = (foo_html_end - foo_html_start);
-    httpd_resp_send(req, (const char *)foo_html_start, foo_html_size);
-    buffer_print();
-    return ESP_OK;
+    int fd;
+    uint32_t version;
+    TickType_t deadline;
+} state_waiter_t;
+
+static httpd_handle_t server_handle = NULL;
+// Handlers run one at a time on the httpd task, so they share one body buffer
+static body_fields_t request_body;
+
+#define PUSH_MAX_CLIENTS 4
+#define PUSH_RING_SLOTS 16
+#define PUSH_MSG_MAX_LEN 224
+#define PUSH_KEEPALIVE_S 15
+
+typedef struct
+{
+    uint16_t len;
+    char data[PUSH_MSG_MAX_LEN];
+} push_msg_t;
+
+typedef struct
+{
+    int fd;
+    uint32_t cursor;  // next message in push_ring to send
+    uint16_t offset;  // bytes of that message already sent
+} push_client_t;
+
+// Only touched from the httpd task: handlers, close_fn and queued work
+static state_waiter_t state_waiters[STATE_LONGPOLL_MAX_WAITERS];
+static int state_waiter_count = 0;
+
+/*
+ * Server-Sent Events fan-out: every event is encoded once into push_ring and
+ * each client walks it with its own cursor, so a client's queue is bounded by
+ * the ring size. Clients lagging a full ring behind are evicted.
+ */
+static push_msg_t push_ring[PUSH_RING_SLOTS];
+static uint32_t push_head = 0;
+static push_client_t push_clients[PUSH_MAX_CLIENTS];
+static int push_client_count = 0;
+static uint32_t push_state_version = 0;
+static uint32_t push_log_cursor = 0;
+static TickType_t push_last_activity = 0;
+
+extern const uint8_t foo_html_start[] asm("_binary_foo_html_start");
+extern const uint8_t foo_html_end[] asm("_binary_foo_html_end");
+extern const uint8_t foo_html_gz_start[] asm("_binary_foo_html_gz_start");
+extern const uint8_t foo_html_gz_end[] asm("_binary_foo_html_gz_end");
+
+/*
+ * Embedded static file, with its build-time gzip variant. The ETag is
+ * derived from the content the first time the asset is served.
+ */
+typedef struct
+{
+    const char *content_type;
+    const uint8_t *start;
+    const uint8_t *end;
+    const uint8_t *gz_start;
+    const uint8_t *gz_end;
+    uint32_t hash;
+} static_asset_t;
+
+static static_asset_t index_asset = {
+    .content_type = "text/html",
+    .start = foo_html_start,
+    .end = foo_html_end,
+    .gz_start = foo_html_gz_start,
+    .gz_end = foo_html_gz_end};
+
+static uint32_t asset_hash(const uint8_t *data, size_t len)
+{
+    // FNV-1a, plenty to tell firmware builds apart
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash ? hash : 1;
+}
+
+static bool req_header_contains(httpd_req_t *req, const char *field, const char *needle)
+{
+    char value[64];
+    esp_err_t err = httpd_req_get_hdr_value_str(req, field, value, sizeof(value));
+    if (err != ESP_OK && err != ESP_ERR_HTTPD_RESULT_TRUNC)
+    {
+        return false;
+    }
+    return strstr(value, needle) != NULL;
+}
+
+static esp_err_t static_asset_handler(httpd_req_t *req)
+{
+    static_asset_t *asset = req->user_ctx;
+    if (asset->hash == 0)
+    {
+        asset->hash = asset_hash(asset->start, asset->end - asset->start);
+    }
+
+    bool gzip = req_header_contains(req, "Accept-Encoding", "gzip");
+
+    // Each encoding is a distinct representation and gets its own strong ETag
+    char etag[16];
+    snprintf(etag, sizeof(etag), "\"%08x%s\"", asset->hash, gzip ? "gz" : "");
+
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "public, max-age=300");
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+
+    if (req_header_contains(req, "If-None-Match", etag))
+    {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    httpd_resp_set_type(req, asset->content_type);
+    if (gzip)
+    {
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+        return httpd_resp_send(req, (const char *)asset->gz_start, asset->gz_end - asset->gz_start);
+    }
+    return httpd_resp_send(req, (const char *)asset->start, asset->end - asset->start);
 }
 
 static esp_err_t logs_get_handler(httpd_req_t *req)
@@ -42,50 +178,353 @@ static esp_err_t logs_get_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
-esp_err_t sta_connect_post_handler(httpd_req_t *req)
+static int state_to_json(char *buf, size_t len, const player_state_t *state)
+{
+    return snprintf(buf, len,
+                    "{\"version\":%u,\"song_id\":%u,\"play_state\":\"%s\",\"volume\":%u,\"position_ms\":%u,\"underruns\":%u}",
+                    state->version, state->song_id, player_state_name(state->play_state),
+                    state->volume, state->position_ms, audio_get_underrun_count());
+}
+
+static void state_send_raw(int fd, const player_state_t *state, bool modified)
+{
+    char body[STATE_JSON_MAX_LEN];
+    char resp[STATE_JSON_MAX_LEN + 160];
+    int len;
+
+    if (modified)
+    {
+        int body_len = state_to_json(body, sizeof(body), state);
+        len = snprintf(resp, sizeof(resp),
+                       "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nETag: \"%u\"\r\n"
+                       "Cache-Control: no-cache\r\nContent-Length: %d\r\n\r\n%s",
+                       state->version, body_len, body);
+    }
+    else
+    {
+        len = snprintf(resp, sizeof(resp),
+                       "HTTP/1.1 304 Not Modified\r\nETag: \"%u\"\r\n"
+                       "Cache-Control: no-cache\r\nContent-Length: 0\r\n\r\n",
+                       state->version);
+    }
+
+    if (httpd_socket_send(server_handle, fd, resp, len, 0) < 0)
+    {
+        ESP_LOGW(TAG, "Long-poll reply to fd %d failed", fd);
+        httpd_sess_trigger_close(server_handle, fd);
+    }
+}
+
+static void state_waiter_remove(int index)
 {
-    char content[100];
-    size_t recv_size = MIN(req->content_len, sizeof(content));
+    state_waiters[index] = state_waiters[--state_waiter_count];
+}
+
+/*
+ * Runs in the httpd task (via webserver_notify_work), answers every parked
+ * long-poll request whose version went stale or whose deadline passed.
+ */
+static void state_longpoll_flush(void)
+{
+    player_state_t state;
+    player_state_get(&state);
+    TickType_t now = xTaskGetTickCount();
 
-    int ret = httpd_req_recv(req, content, recv_size);
-    if (ret <= 0)
+    for (int i = 0; i < state_waiter_count;)
     {
-        if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+        bool changed = state_waiters[i].version != state.version;
+        if (changed || (int32_t)(now - state_waiters[i].deadline) >= 0)
         {
-            httpd_resp_send_408(req);
+            state_send_raw(state_waiters[i].fd, &state, changed);
+            state_waiter_remove(i);
+        }
+        else
+        {
+            i++;
         }
-        return ESP_FAIL;
     }
+}
+
+static void push_encode(const char *fmt, ...)
+{
+    push_msg_t *msg = &push_ring[push_head % PUSH_RING_SLOTS];
+
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(msg->data, sizeof(msg->data), fmt, args);
+    va_end(args);
 
-    if (recv_size < sizeof(content))
+    msg->len = MIN(len, sizeof(msg->data) - 1);
+    push_head++;
+    push_last_activity = xTaskGetTickCount();
+}
+
+static void push_client_remove(int index, bool close_session)
+{
+    int fd = push_clients[index].fd;
+    push_clients[index] = push_clients[--push_client_count];
+
+    if (close_session)
     {
-        content[recv_size] = '\0';
+        ESP_LOGW(TAG, "Evicting push client fd %d", fd);
+        httpd_sess_trigger_close(server_handle, fd);
     }
-    else
+}
+
+// Sends as much of the client's backlog as the socket takes without blocking
+static bool push_client_drain(push_client_t *client)
+{
+    while (client->cursor != push_head)
+    {
+        if (push_head - client->cursor > PUSH_RING_SLOTS)
+        {
+            return false;
+        }
+
+        const push_msg_t *msg = &push_ring[client->cursor % PUSH_RING_SLOTS];
+        int sent = httpd_socket_send(server_handle, client->fd, msg->data + client->offset,
+                                     msg->len - client->offset, MSG_DONTWAIT);
+        if (sent == HTTPD_SOCK_ERR_TIMEOUT || sent == 0)
+        {
+            return true;
+        }
+        if (sent < 0)
+        {
+            return false;
+        }
+
+        client->offset += sent;
+        if (client->offset < msg->len)
+        {
+            return true;
+        }
+
+        client->offset = 0;
+        client->cursor++;
+    }
+
+    return true;
+}
+
+static void push_drain_all(void)
+{
+    for (int i = 0; i < push_client_count;)
+    {
+        if (push_client_drain(&push_clients[i]))
+        {
+            i++;
+        }
+        else
+        {
+            push_client_remove(i, true);
+        }
+    }
+}
+
+/*
+ * Clients are drained after every message rather than once at the end, a
+ * burst of log entries longer than the ring would otherwise put everyone,
+ * fast readers included, a full ring behind and get them all evicted.
+ */
+static void push_flush(void)
+{
+    if (push_client_count == 0)
+    {
+        return;
+    }
+
+    player_state_t state;
+    player_state_get(&state);
+    if (state.version != push_state_version)
+    {
+        char body[STATE_JSON_MAX_LEN];
+        state_to_json(body, sizeof(body), &state);
+        push_encode("event: state\ndata: %s\n\n", body);
+        push_state_version = state.version;
+        push_drain_all();
+    }
+
+    buffer_entry_t entries[BUFFER_SIZE];
+    size_t count = buffer_read_since(&push_log_cursor, entries, BUFFER_SIZE);
+    for (int i = 0; i < count && push_client_count > 0; i++)
+    {
+        push_encode("event: log\ndata: {\"event\":\"%s\",\"song_id\":%u,\"timestamp\":%lld}\n\n",
+                    getEventName(entries[i].event), entries[i].song_id, (long long)entries[i].timestamp);
+        push_drain_all();
+    }
+
+    if (xTaskGetTickCount() - push_last_activity >= (PUSH_KEEPALIVE_S * 1000) / portTICK_PERIOD_MS)
+    {
+        // SSE comment line, keeps proxies happy and flushes out dead peers
+        push_encode(": keepalive\n\n");
+    }
+
+    // Also retries clients whose socket was full last time round
+    push_drain_all();
+}
+
+static void webserver_notify_work(void *arg)
+{
+    state_longpoll_flush();
+    push_flush();
+}
+
+static void webserver_notify_task(void *arg)
+{
+    while (1)
+    {
+        // Woken by player state and logger changes, otherwise tick once a
+        // second for long-poll deadlines, keepalives and stalled clients
+        ulTaskNotifyTake(pdTRUE, 1000 / portTICK_PERIOD_MS);
+
+        if ((state_waiter_count > 0 || push_client_count > 0) && server_handle != NULL)
+        {
+            httpd_queue_work(server_handle, webserver_notify_work, NULL);
+        }
+    }
+}
+
+static void webserver_close_fn(httpd_handle_t hd, int sockfd)
+{
+    for (int i = 0; i < state_waiter_count; i++)
+    {
+        if (state_waiters[i].fd == sockfd)
+        {
+            state_waiter_remove(i);
+            break;
+        }
+    }
+
+    for (int i = 0; i < push_client_count; i++)
+    {
+        if (push_clients[i].fd == sockfd)
+        {
+            push_client_remove(i, false);
+            break;
+        }
+    }
+
+    close(sockfd);
+}
+
+static esp_err_t events_get_handler(httpd_req_t *req)
+{
+    if (push_client_count >= PUSH_MAX_CLIENTS)
+    {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_send(req, "Too many event clients", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
+    }
+
+    if (push_client_count == 0)
     {
-        content[sizeof(content) - 1] = '\0';
+        // Nobody was listening, don't replay what happened in the meantime
+        push_state_version = player_state_version();
+        push_log_cursor = buffer_cursor();
     }
 
-    ESP_LOGI(TAG, "Received content: %s", content);
+    int fd = httpd_req_to_sockfd(req);
+    player_state_t state;
+    player_state_get(&state);
+
+    char body[STATE_JSON_MAX_LEN];
+    char resp[STATE_JSON_MAX_LEN + 160];
+    state_to_json(body, sizeof(body), &state);
+    int len = snprintf(resp, sizeof(resp),
+                       "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                       "Cache-Control: no-cache\r\nConnection: keep-alive\r\n\r\n"
+                       "event: state\ndata: %s\n\n",
+                       body);
 
-    cJSON *json = cJSON_Parse(content);
-    if (json == NULL)
+    if (httpd_socket_send(server_handle, fd, resp, len, 0) != len)
     {
-        ESP_LOGE(TAG, "Failed to parse JSON");
+        return ESP_FAIL;
+    }
+
+    // The session stays open, later events are written by push_flush
+    push_client_t *client = &push_clients[push_client_count++];
+    client->fd = fd;
+    client->cursor = push_head;
+    client->offset = 0;
+    return ESP_OK;
+}
+
+static esp_err_t state_get_handler(httpd_req_t *req)
+{
+    player_state_t state;
+    player_state_get(&state);
+
+    char etag[16];
+    snprintf(etag, sizeof(etag), "\"%u\"", state.version);
+
+    char if_none_match[16];
+    bool not_modified = httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK &&
+                        strcmp(if_none_match, etag) == 0;
+
+    if (not_modified)
+    {
+        char query[32];
+        char wait_str[8];
+        int wait_s = 0;
+
+        if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+            httpd_query_key_value(query, "wait", wait_str, sizeof(wait_str)) == ESP_OK)
+        {
+            wait_s = MIN(atoi(wait_str), STATE_LONGPOLL_MAX_WAIT_S);
+        }
+
+        if (wait_s > 0 && state_waiter_count < STATE_LONGPOLL_MAX_WAITERS)
+        {
+            // Park the socket, the reply is sent later by state_longpoll_flush
+            state_waiter_t *waiter = &state_waiters[state_waiter_count++];
+            waiter->fd = httpd_req_to_sockfd(req);
+            waiter->version = state.version;
+            waiter->deadline = xTaskGetTickCount() + (wait_s * 1000) / portTICK_PERIOD_MS;
+            return ESP_OK;
+        }
+
+        httpd_resp_set_status(req, "304 Not Modified");
+        httpd_resp_set_hdr(req, "ETag", etag);
+        httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+        httpd_resp_send(req, NULL, 0);
+        return ESP_OK;
+    }
+
+    char body[STATE_JSON_MAX_LEN];
+    state_to_json(body, sizeof(body), &state);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    httpd_resp_send(req, body, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+esp_err_t sta_connect_post_handler(httpd_req_t *req)
+{
+    body_fields_t *body = &request_body;
+
+    esp_err_t err = body_read_fields(req, body);
+    if (err == ESP_FAIL)
+    {
+        return ESP_FAIL;
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to parse JSON (%s)", body_error_message(body, err));
         const char resp[] = "Invalid JSON";
         httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
         return ESP_FAIL;
     }
 
-    const cJSON *ssid_json = cJSON_GetObjectItemCaseSensitive(json, "ssid");
-    const cJSON *password_json = cJSON_GetObjectItemCaseSensitive(json, "password");
+    const char *ssid = body_get_string(body, "ssid");
+    const char *password = body_get_string(body, "password");
 
-    if (cJSON_IsString(ssid_json) && (ssid_json->valuestring != NULL) &&
-        cJSON_IsString(password_json) && (password_json->valuestring != NULL))
+    if (ssid != NULL && password != NULL)
     {
-        ESP_LOGI(TAG, "Parsed SSID: %s", ssid_json->valuestring);
-        ESP_LOGI(TAG, "Parsed Password: %s", password_json->valuestring);
-        // int status = wifi_init_sta(ssid_json->valuestring, password_json->valuestring);
+        ESP_LOGI(TAG, "Parsed SSID: %s", ssid);
+        ESP_LOGI(TAG, "Parsed Password: %s", password);
+        // int status = wifi_init_sta(ssid, password);
         int status = 200;
         if (status == 200)
         {
@@ -101,20 +540,95 @@ esp_err_t sta_connect_post_handler(httpd_req_t *req)
     else
     {
         ESP_LOGE(TAG, "JSON does not contain expected fields");
-        cJSON_Delete(json);
         const char resp[] = "Invalid JSON fields";
         httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
         return ESP_FAIL;
     }
 
-    cJSON_Delete(json);
     return ESP_OK;
 }
 
+static esp_err_t touch_stats_get_handler(httpd_req_t *req)
+{
+    touch_stats_t stats;
+    touch_get_stats(&stats);
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "events", stats.events);
+    cJSON_AddNumberToObject(root, "dropped", stats.dropped);
+    cJSON_AddNumberToObject(root, "max_depth", stats.max_depth);
+    cJSON_AddItemToObject(root, "dispatch_us", cJSON_CreateIntArray((const int *)stats.dispatch_us, TOUCH_LATENCY_BUCKETS));
+    cJSON_AddItemToObject(root, "command_us", cJSON_CreateIntArray((const int *)stats.command_us, TOUCH_LATENCY_BUCKETS));
+
+    char *json_string = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (json_string == NULL)
+    {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_string, HTTPD_RESP_USE_STRLEN);
+    free(json_string);
+    return ESP_OK;
+}
+
+/*!< GET /command-stats: per-source counters and queueing latency of the command router */
+static esp_err_t command_stats_get_handler(httpd_req_t *req)
+{
+    cJSON *root = cJSON_CreateObject();
+
+    for (int i = 0; i < COMMAND_SOURCE_MAX; i++)
+    {
+        command_source_stats_t stats;
+        command_router_get_stats(i, &stats);
+
+        cJSON *source = cJSON_CreateObject();
+        cJSON_AddNumberToObject(source, "accepted", stats.accepted);
+        cJSON_AddNumberToObject(source, "invalid", stats.invalid);
+        cJSON_AddNumberToObject(source, "rate_limited", stats.rate_limited);
+        cJSON_AddNumberToObject(source, "held_off", stats.held_off);
+        cJSON_AddNumberToObject(source, "failed", stats.failed);
+        cJSON_AddNumberToObject(source, "latency_avg_us", stats.accepted ? (double)(stats.latency_total_us / stats.accepted) : 0);
+        cJSON_AddNumberToObject(source, "latency_max_us", stats.latency_max_us);
+        cJSON_AddItemToObject(root, command_source_name(i), source);
+    }
+
+    char *json_string = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (json_string == NULL)
+    {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_string, HTTPD_RESP_USE_STRLEN);
+    free(json_string);
+    return ESP_OK;
+}
+
+/*!< Whole decimal numbers that fit a command value, nothing before or after */
+static bool parse_int32(const char *text, int32_t *out)
+{
+    char *end;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno != 0 || value < INT32_MIN || value > INT32_MAX)
+    {
+        return false;
+    }
+    *out = value;
+    return true;
+}
+
 esp_err_t event_type_handler(httpd_req_t *req)
 {
     char query[100];
     char event_str[10];
+    char value_str[12];
+    bool has_value = false;
 
     if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
     {
@@ -123,6 +637,7 @@ esp_err_t event_type_handler(httpd_req_t *req)
         if (httpd_query_key_value(query, "event", event_str, sizeof(event_str)) == ESP_OK)
         {
             ESP_LOGI(TAG, "Found URL query parameter => event=%s", event_str);
+            has_value = httpd_query_key_value(query, "value", value_str, sizeof(value_str)) == ESP_OK;
         }
         else
         {
@@ -140,101 +655,247 @@ esp_err_t event_type_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
 
-    EventType event = atoi(event_str);
-    circular_buffer_t local_buffer = get_buffer_from_nvs();
-    uint8_t last_song_id = (local_buffer.count > 0) ? local_buffer.data[(local_buffer.tail + local_buffer.count - 1) % BUFFER_SIZE].song_id : 0;
-
-    switch (event)
+    int32_t event_id;
+    int32_t value = 0;
+    if (!parse_int32(event_str, &event_id))
     {
-    case 0:
-    {
-        send_command(PLAY_PAUSE_AUDIO);
+        const char resp[] = "Invalid query parameter: event";
+        httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
+        return ESP_FAIL;
     }
-    break;
-
-    case 1:
+    if (has_value && !parse_int32(value_str, &value))
     {
-        send_command(NEXT_AUDIO);
+        const char resp[] = "Invalid query parameter: value";
+        httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
+        return ESP_FAIL;
     }
-    break;
 
-    case 2:
-    {
-        send_command(PREVIOUS_AUDIO);
-    }
-    break;
+    EventType event = event_id;
+    player_state_t state;
+    player_state_get(&state);
 
-    case 3:
+    esp_err_t err = command_route_event(COMMAND_SOURCE_HTTP, event, has_value, value);
+    if (err == ESP_ERR_INVALID_ARG)
     {
-        send_command(STOP_AUDIO);
+        const char resp[] = "Invalid query parameter: value";
+        httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
+        return ESP_FAIL;
     }
-    break;
-
-    case 4:
+    else if (err == ESP_ERR_INVALID_STATE)
     {
-        send_command(VOL_UP_AUDIO);
+        httpd_resp_set_status(req, "429 Too Many Requests");
+        httpd_resp_send(req, "Busy, try again", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
     }
-    break;
-
-    case 5:
+    else if (err == ESP_FAIL)
     {
-        send_command(VOL_DOWN_AUDIO);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Player not ready");
+        return ESP_FAIL;
     }
-    break;
-    default:
+    else if (err == ESP_ERR_NOT_SUPPORTED)
     {
         ESP_LOGW(TAG, "Comando no reconocido.");
     }
-    break;
-    }
 
-    ESP_LOGI(TAG, "Event: %s, Song ID: %d", getEventName(event), last_song_id);
+    ESP_LOGI(TAG, "Event: %s, Song ID: %d", getEventName(event), state.song_id);
 
     const char resp[] = "Event received and processed";
     httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
     return ESP_OK;
 }
 
-esp_err_t mqtt_connect_handler(httpd_req_t *req)
+typedef struct
+{
+    audio_action_t actions[AUDIO_BATCH_MAX];
+    int count;
+    bool list_next; /*!< the value about to start belongs to "commands" */
+    bool in_list;
+    bool seen_list;
+    bool too_many;
+    bool invalid;
+    // Members of the command object being read
+    char key[8];
+    bool has_command;
+    bool has_value;
+    bool needs_value;
+} batch_parse_t;
+
+/*
+ * Picks {"command","value"} objects out of the "commands" array as they go
+ * past. Depth 1 is the body object, 2 the array, 3 the members of an item;
+ * any other key is ignored.
+ */
+static bool batch_parse_cb(json_stream_event_t event, const char *text, size_t len, int depth, void *arg)
 {
-    char content[100];
-    size_t recv_size = MIN(req->content_len, sizeof(content));
+    batch_parse_t *batch = arg;
 
-    int ret = httpd_req_recv(req, content, recv_size);
-    if (ret <= 0)
+    if (depth == 0)
     {
-        if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+        return event == JSON_STREAM_OBJECT_START || event == JSON_STREAM_OBJECT_END;
+    }
+
+    if (depth == 1)
+    {
+        if (event == JSON_STREAM_KEY)
+        {
+            batch->list_next = strcmp(text, "commands") == 0;
+        }
+        else if (event == JSON_STREAM_ARRAY_START && batch->list_next)
+        {
+            // Repeated key, last one wins
+            batch->count = 0;
+            batch->in_list = true;
+            batch->seen_list = true;
+        }
+        else if (event == JSON_STREAM_ARRAY_END)
         {
-            httpd_resp_send_408(req);
+            batch->in_list = false;
         }
+        else if (batch->list_next)
+        {
+            batch->seen_list = false; // "commands" is not an array
+        }
+        return true;
+    }
+
+    if (!batch->in_list)
+    {
+        return true;
+    }
+
+    if (depth == 2)
+    {
+        if (event == JSON_STREAM_OBJECT_START)
+        {
+            if (batch->count == AUDIO_BATCH_MAX)
+            {
+                batch->too_many = true;
+                return false;
+            }
+            batch->key[0] = '\0';
+            batch->has_command = false;
+            batch->has_value = false;
+            batch->needs_value = false;
+            return true;
+        }
+        if (event != JSON_STREAM_OBJECT_END)
+        {
+            batch->invalid = true;
+            return false;
+        }
+        if (!batch->has_command || (batch->needs_value && !batch->has_value))
+        {
+            batch->invalid = true;
+            return false;
+        }
+        if (!batch->has_value)
+        {
+            batch->actions[batch->count].value = 0;
+        }
+        batch->count++;
+        return true;
+    }
+
+    if (depth > 3)
+    {
+        return true;
+    }
+
+    audio_action_t *action = &batch->actions[batch->count];
+    if (event == JSON_STREAM_KEY)
+    {
+        snprintf(batch->key, sizeof(batch->key), "%s", len < sizeof(batch->key) ? text : "");
+    }
+    else if (strcmp(batch->key, "command") == 0)
+    {
+        int32_t value = action->value;
+        if (event != JSON_STREAM_STRING || !command_lookup_name(text, len, action, &batch->needs_value))
+        {
+            batch->invalid = true;
+            return false;
+        }
+        // The lookup resets the action, keep a value that came first
+        action->value = value;
+        batch->has_command = true;
+    }
+    else if (strcmp(batch->key, "value") == 0 && event == JSON_STREAM_NUMBER)
+    {
+        if (!parse_int32(text, &action->value))
+        {
+            batch->invalid = true;
+            return false;
+        }
+        batch->has_value = true;
+    }
+    return true;
+}
+
+/*
+ * POST /commands {"commands":[{"command":"volume","value":70},{"command":"play"}]}
+ * The whole list is validated first and then handed to the audio engine as
+ * one message, so it is applied atomically or not at all.
+ */
+static esp_err_t commands_post_handler(httpd_req_t *req)
+{
+    batch_parse_t batch = {0};
+    json_stream_init(&request_body.stream, batch_parse_cb, &batch);
+
+    esp_err_t err = body_read_json(req, &request_body.stream);
+    if (err == ESP_FAIL)
+    {
+        return ESP_FAIL;
+    }
+    if (batch.invalid)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid command");
+        return ESP_FAIL;
+    }
+    if (err != ESP_OK || batch.too_many || !batch.seen_list || batch.count == 0)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected 1 to " STR(AUDIO_BATCH_MAX) " commands");
         return ESP_FAIL;
     }
 
-    if (recv_size < sizeof(content))
+    err = command_route(COMMAND_SOURCE_HTTP, batch.actions, batch.count);
+    if (err == ESP_ERR_INVALID_STATE)
     {
-        content[recv_size] = '\0';
+        httpd_resp_set_status(req, "429 Too Many Requests");
+        httpd_resp_send(req, "Busy, try again", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
     }
-    else
+    else if (err != ESP_OK)
     {
-        content[sizeof(content) - 1] = '\0';
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Player not ready");
+        return ESP_FAIL;
     }
 
-    cJSON *json = cJSON_Parse(content);
-    if (json == NULL)
+    const char resp[] = "Commands received and processed";
+    httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+esp_err_t mqtt_connect_handler(httpd_req_t *req)
+{
+    body_fields_t *body = &request_body;
+
+    esp_err_t err = body_read_fields(req, body);
+    if (err == ESP_FAIL)
+    {
+        return ESP_FAIL;
+    }
+    if (err != ESP_OK)
     {
         const char resp[] = "Invalid JSON";
         httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
         return ESP_FAIL;
     }
 
-    const cJSON *broker_json = cJSON_GetObjectItemCaseSensitive(json, "broker");
-    const cJSON *topic_json = cJSON_GetObjectItemCaseSensitive(json, "topic");
+    const char *broker = body_get_string(body, "broker");
+    const char *topic = body_get_string(body, "topic");
 
-    if (cJSON_IsString(broker_json) && (broker_json->valuestring != NULL) &&
-        cJSON_IsString(topic_json) && (topic_json->valuestring != NULL))
+    if (broker != NULL && topic != NULL)
     {
-        esp_err_t res = mqtt_app_start(broker_json->valuestring, topic_json->valuestring);
-        cJSON_Delete(json);
+        esp_err_t res = mqtt_app_start(broker, topic);
 
         if (res == ESP_OK)
         {
@@ -251,7 +912,6 @@ esp_err_t mqtt_connect_handler(httpd_req_t *req)
     }
     else
     {
-        cJSON_Delete(json);
         const char resp[] = "Invalid JSON fields";
         httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
         return ESP_FAIL;
@@ -277,51 +937,31 @@ static esp_err_t config_get_handler(httpd_req_t *req)
 
 static esp_err_t config_post_handler(httpd_req_t *req)
 {
-    char content[100];
-    size_t recv_size = MIN(req->content_len, sizeof(content));
+    body_fields_t *body = &request_body;
 
-    int ret = httpd_req_recv(req, content, recv_size);
-    if (ret <= 0)
+    esp_err_t err = body_read_fields(req, body);
+    if (err == ESP_FAIL)
     {
-        if (ret == HTTPD_SOCK_ERR_TIMEOUT)
-        {
-            httpd_resp_send_408(req);
-        }
         return ESP_FAIL;
     }
-
-    if (recv_size < sizeof(content))
-    {
-        content[recv_size] = '\0';
-    }
-    else
-    {
-        content[sizeof(content) - 1] = '\0';
-    }
-
-    ESP_LOGI(TAG, "Received content: %s", content);
-
-    cJSON *json = cJSON_Parse(content);
-    if (json == NULL)
+    if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to parse JSON");
+        ESP_LOGE(TAG, "Failed to parse JSON (%s)", body_error_message(body, err));
         const char resp[] = "Invalid JSON";
         httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
         return ESP_FAIL;
     }
 
-    const cJSON *key_json = cJSON_GetObjectItemCaseSensitive(json, "key");
-    const cJSON *value_json = cJSON_GetObjectItemCaseSensitive(json, "value");
+    const char *key = body_get_string(body, "key");
+    const char *value = body_get_string(body, "value");
 
-    if (cJSON_IsString(key_json) && (key_json->valuestring != NULL) &&
-        cJSON_IsString(value_json) && (value_json->valuestring != NULL))
+    if (key != NULL && value != NULL)
     {
-        ESP_LOGI(TAG, "Parsed key: %s, value: %s", key_json->valuestring, value_json->valuestring);
-        esp_err_t err = config_set_value(key_json->valuestring, value_json->valuestring);
+        ESP_LOGI(TAG, "Parsed key: %s, value: %s", key, value);
+        err = config_set_value(key, value);
         if (err != ESP_OK)
         {
             ESP_LOGE(TAG, "Failed to set config value");
-            cJSON_Delete(json);
             const char resp[] = "Failed to set config value";
             httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
             return ESP_FAIL;
@@ -330,23 +970,79 @@ static esp_err_t config_post_handler(httpd_req_t *req)
     else
     {
         ESP_LOGE(TAG, "JSON does not contain expected fields");
-        cJSON_Delete(json);
         const char resp[] = "Invalid JSON fields";
         httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
         return ESP_FAIL;
     }
 
-    cJSON_Delete(json);
-
     const char resp[] = "Config set successfully";
     httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
     return ESP_OK;
 }
 
+/*
+ * PATCH /config {"broker":"mqtt://host","tlm_interval":5000,"tlm_enabled":true}
+ * Every pair is checked against the schema before anything is applied,
+ * then all of them go to NVS in one commit, or none if a write fails.
+ */
+static esp_err_t config_patch_handler(httpd_req_t *req)
+{
+    body_fields_t *body = &request_body;
+    config_kv_t kvs[BODY_FIELDS_MAX];
+
+    esp_err_t err = body_read_fields(req, body);
+    if (err == ESP_FAIL)
+    {
+        return ESP_FAIL;
+    }
+    if (err != ESP_OK || body->count == 0)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, err != ESP_OK ? body_error_message(body, err) : "No settings given");
+        return ESP_FAIL;
+    }
+
+    // Name the first offending key rather than failing the whole batch blindly
+    for (size_t i = 0; i < body->count; i++)
+    {
+        kvs[i].key = body->fields[i].key;
+        kvs[i].value = body->fields[i].value;
+        err = kvs[i].value == NULL ? ESP_ERR_INVALID_ARG : config_validate(kvs[i].key, kvs[i].value);
+        if (err != ESP_OK)
+        {
+            char message[64];
+            snprintf(message, sizeof(message), "%s: %s", kvs[i].key,
+                     err == ESP_ERR_NOT_FOUND ? "unknown setting" : "invalid value");
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, message);
+            return ESP_FAIL;
+        }
+    }
+
+    err = config_set_values(kvs, body->count);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to apply %d settings (%s)", (int)body->count, esp_err_to_name(err));
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to set config values");
+        return ESP_FAIL;
+    }
+
+    // Already live and seen by subscribers, only saving them can fail now
+    err = config_commit();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Applied %d settings but failed to save them (%s)", (int)body->count, esp_err_to_name(err));
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Settings applied but not saved, they are lost on reboot");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Applied %d settings", (int)body->count);
+    return config_get_handler(req);
+}
+
 static const httpd_uri_t hello = {
     .uri = "/",
     .method = HTTP_GET,
-    .handler = hello_get_handler};
+    .handler = static_asset_handler,
+    .user_ctx = &index_asset};
 
 static const httpd_uri_t sta_connect = {
     .uri = "/sta-connect",
@@ -363,6 +1059,31 @@ static const httpd_uri_t logs = {
     .method = HTTP_GET,
     .handler = logs_get_handler};
 
+static const httpd_uri_t state_uri = {
+    .uri = "/state",
+    .method = HTTP_GET,
+    .handler = state_get_handler};
+
+static const httpd_uri_t events_uri = {
+    .uri = "/events",
+    .method = HTTP_GET,
+    .handler = events_get_handler};
+
+static const httpd_uri_t touch_stats_uri = {
+    .uri = "/touch-stats",
+    .method = HTTP_GET,
+    .handler = touch_stats_get_handler};
+
+static const httpd_uri_t command_stats_uri = {
+    .uri = "/command-stats",
+    .method = HTTP_GET,
+    .handler = command_stats_get_handler};
+
+static const httpd_uri_t commands_uri = {
+    .uri = "/commands",
+    .method = HTTP_POST,
+    .handler = commands_post_handler};
+
 static const httpd_uri_t mqtt_connect = {
     .uri = "/mqtt-connect",
     .method = HTTP_POST,
@@ -378,14 +1099,31 @@ static const httpd_uri_t config_post_uri = {
     .method = HTTP_POST,
     .handler = config_post_handler};
 
+static const httpd_uri_t config_patch_uri = {
+    .uri = "/config",
+    .method = HTTP_PATCH,
+    .handler = config_patch_handler};
+
 static httpd_handle_t start_webserver(void)
 {
     httpd_handle_t server = NULL;
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.max_open_sockets = CONFIG_WEBSERVER_MAX_OPEN_SOCKETS;
+    config.max_uri_handlers = CONFIG_WEBSERVER_MAX_URI_HANDLERS;
+    config.stack_size = CONFIG_WEBSERVER_TASK_STACK_SIZE;
+    config.task_priority = CONFIG_WEBSERVER_TASK_PRIORITY;
+    config.core_id = CONFIG_WEBSERVER_TASK_CORE_ID < 0 ? tskNO_AFFINITY : CONFIG_WEBSERVER_TASK_CORE_ID;
+    config.recv_wait_timeout = CONFIG_WEBSERVER_RECV_WAIT_TIMEOUT;
+    config.send_wait_timeout = CONFIG_WEBSERVER_SEND_WAIT_TIMEOUT;
+#ifdef CONFIG_WEBSERVER_LRU_PURGE
     config.lru_purge_enable = true;
+#endif
+    config.close_fn = webserver_close_fn;
 
     // Start the httpd server
     ESP_LOGI(TAG, "Starting server on port: '%d'", config.server_port);
+    ESP_LOGI(TAG, "Server profile: sockets %d, handlers %d, stack %d, priority %d",
+             config.max_open_sockets, config.max_uri_handlers, (int)config.stack_size, config.task_priority);
     if (httpd_start(&server, &config) == ESP_OK)
     {
         // Set URI handlers
@@ -393,10 +1131,16 @@ static httpd_handle_t start_webserver(void)
         httpd_register_uri_handler(server, &hello);
         httpd_register_uri_handler(server, &sta_connect);
         httpd_register_uri_handler(server, &logs);
+        httpd_register_uri_handler(server, &state_uri);
+        httpd_register_uri_handler(server, &events_uri);
         httpd_register_uri_handler(server, &event_type);
+        httpd_register_uri_handler(server, &commands_uri);
+        httpd_register_uri_handler(server, &touch_stats_uri);
+        httpd_register_uri_handler(server, &command_stats_uri);
         httpd_register_uri_handler(server, &mqtt_connect);
         httpd_register_uri_handler(server, &config_get_uri);
         httpd_register_uri_handler(server, &config_post_uri);
+        httpd_register_uri_handler(server, &config_patch_uri);
         return server;
     }
 
@@ -412,5 +1156,13 @@ static void stop_webserver(httpd_handle_t server)
 void init_webserver(void)
 {
     ESP_LOGI(TAG, "Starting HTTP Server");
-    start_webserver();
+    server_handle = start_webserver();
+
+    TaskHandle_t notify_task = NULL;
+    xTaskCreate(webserver_notify_task, "webserver_notify_task", 2048, NULL, 4, &notify_task);
+    if (notify_task != NULL)
+    {
+        player_state_subscribe(notify_task);
+        logger_subscribe(notify_task);
+    }
 }
@@ -15,9 +15,29 @@
 #include "logger.h"
 #include "myspiffs.h"
 #include "i2c_bus.h"
+#include "config.h"
 
 #define TAG "main"
 
+/*!< "log_level" options are listed in esp_log_level_t order */
+static void log_level_changed(const char *key, const char *value, void *arg)
+{
+    const config_schema_t *schema = config_schema_find("log_level");
+    char level[16];
+
+    if (config_get_value("log_level", level, sizeof(level)) != ESP_OK)
+    {
+        return;
+    }
+    for (int i = 0; schema->options[i] != NULL; i++)
+    {
+        if (strcmp(schema->options[i], level) == 0)
+        {
+            esp_log_level_set("*", (esp_log_level_t)i);
+        }
+    }
+}
+
 void app_main()
 {
     esp_err_t ret = nvs_flash_init();
@@ -28,6 +48,9 @@ void app_main()
     }
 
     ESP_ERROR_CHECK(ret);
+    ESP_ERROR_CHECK(config_init());
+    log_level_changed(NULL, NULL, NULL);
+    ESP_ERROR_CHECK(config_subscribe("log_level", log_level_changed, NULL));
     ESP_ERROR_CHECK(spiffs_init());
     i2c_bus_init();
     touch_init();
@@ -0,0 +1,313 @@
+/*
+ * Host-side stress test for the logger's lock-free ring
+ * (components/logger/log_ring.c), no board needed.
+ *
+ *   gcc -O2 -pthread -Icomponents/logger/include -o log_ring_stress tools/log_ring_stress.c
+ *   ./log_ring_stress                  # 8 writers, 200000 entries each
+ *   ./log_ring_stress -w 16 -n 50000   # more writers, fewer entries
+ *
+ * Writers push entries that carry their own check fields while a consumer
+ * pops and seqlock readers take snapshots and follow cursors. Any torn
+ * entry, duplicate or per-writer reordering fails the run. A second phase
+ * pushes exactly BUFFER_SIZE entries per round from all writers at once
+ * and requires every one of them to be popped back, so nothing is lost
+ * while the ring is within capacity.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*!< logger.h pulls in FreeRTOS, stand in for the two things log_ring needs */
+#define LOGGER_H
+#define BUFFER_SIZE 20
+
+typedef enum {
+    PLAY_PAUSE = 0,
+} EventType;
+
+typedef struct {
+    EventType event;
+    uint8_t song_id;
+    int64_t timestamp;
+} buffer_entry_t;
+
+#include "../components/logger/log_ring.c"
+
+#define WRITERS_MAX 64
+#define SNAPSHOT_READERS 2
+#define CURSOR_READERS 2
+
+static log_ring_t ring;
+static int writer_count = 8;
+static long per_writer = 200000;
+static atomic_int writers_done;
+static atomic_long failures;
+
+/*!< timestamp holds writer and counter, event and song_id are derived from it */
+static buffer_entry_t make_entry(int writer, long n)
+{
+    int64_t ts = ((int64_t)writer << 40) | n;
+    buffer_entry_t e = {
+        .event = (EventType)(ts % 9),
+        .song_id = (uint8_t)((ts * 2654435761u) >> 24),
+        .timestamp = ts,
+    };
+    return e;
+}
+
+static bool check_entry(const buffer_entry_t *e, int *writer, long *n)
+{
+    buffer_entry_t want;
+
+    *writer = (int)(e->timestamp >> 40);
+    *n = (long)(e->timestamp & ((1LL << 40) - 1));
+    if (*writer < 0 || *writer >= writer_count) {
+        return false;
+    }
+    want = make_entry(*writer, *n);
+    return e->event == want.event && e->song_id == want.song_id;
+}
+
+static void fail(const char *who, const char *what, const buffer_entry_t *e)
+{
+    atomic_fetch_add(&failures, 1);
+    fprintf(stderr, "%s: %s (event %d song %u ts 0x%llx)\n",
+            who, what, e->event, e->song_id, (unsigned long long)e->timestamp);
+}
+
+/*!< Entries from one writer must come out in push order, each at most once */
+static void check_order(const char *who, long *last, const buffer_entry_t *e)
+{
+    int writer;
+    long n;
+
+    if (!check_entry(e, &writer, &n)) {
+        fail(who, "torn entry", e);
+        return;
+    }
+    if (n <= last[writer]) {
+        fail(who, n == last[writer] ? "duplicate entry" : "out of order entry", e);
+    }
+    last[writer] = n;
+}
+
+static void *writer_task(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+
+    for (long n = 0; n < per_writer; n++) {
+        buffer_entry_t e = make_entry(id, n);
+        log_ring_push(&ring, &e);
+        /*!< flat out, the ring always has a slot mid-write and readers starve */
+        if ((n & 63) == 0) {
+            sched_yield();
+        }
+    }
+    atomic_fetch_add(&writers_done, 1);
+    return NULL;
+}
+
+static void *consumer_task(void *arg)
+{
+    long last[WRITERS_MAX];
+    long *popped = arg;
+    buffer_entry_t e;
+
+    memset(last, 0xff, sizeof(last));
+    while (atomic_load(&writers_done) < writer_count) {
+        while (log_ring_pop(&ring, &e)) {
+            check_order("pop", last, &e);
+            (*popped)++;
+        }
+        sched_yield();
+    }
+    while (log_ring_pop(&ring, &e)) {
+        check_order("pop", last, &e);
+        (*popped)++;
+    }
+    return NULL;
+}
+
+static void *snapshot_task(void *arg)
+{
+    buffer_entry_t out[BUFFER_SIZE];
+    long *reads = arg;
+
+    while (atomic_load(&writers_done) < writer_count) {
+        long last[WRITERS_MAX];
+        size_t count = log_ring_snapshot(&ring, out, BUFFER_SIZE);
+
+        memset(last, 0xff, sizeof(last));
+        for (size_t i = 0; i < count; i++) {
+            check_order("snapshot", last, &out[i]);
+        }
+        if (log_ring_last(&ring, &out[0])) {
+            int writer;
+            long n;
+            if (!check_entry(&out[0], &writer, &n)) {
+                fail("last", "torn entry", &out[0]);
+            }
+        }
+        (*reads)++;
+        sched_yield();
+    }
+    return NULL;
+}
+
+static void *cursor_task(void *arg)
+{
+    buffer_entry_t out[BUFFER_SIZE];
+    long last[WRITERS_MAX];
+    long *reads = arg;
+    uint32_t cursor = 0;
+
+    memset(last, 0xff, sizeof(last));
+    while (atomic_load(&writers_done) < writer_count) {
+        size_t count = log_ring_read_from(&ring, &cursor, out, BUFFER_SIZE);
+        for (size_t i = 0; i < count; i++) {
+            check_order("cursor", last, &out[i]);
+        }
+        *reads += count;
+        sched_yield();
+    }
+    return NULL;
+}
+
+static void run_concurrent(void)
+{
+    pthread_t writers[WRITERS_MAX], consumer, snapshots[SNAPSHOT_READERS], cursors[CURSOR_READERS];
+    long popped = 0, snapshot_reads[SNAPSHOT_READERS] = {0}, cursor_reads[CURSOR_READERS] = {0};
+
+    log_ring_reset(&ring);
+    atomic_store(&writers_done, 0);
+
+    pthread_create(&consumer, NULL, consumer_task, &popped);
+    for (int i = 0; i < SNAPSHOT_READERS; i++) {
+        pthread_create(&snapshots[i], NULL, snapshot_task, &snapshot_reads[i]);
+    }
+    for (int i = 0; i < CURSOR_READERS; i++) {
+        pthread_create(&cursors[i], NULL, cursor_task, &cursor_reads[i]);
+    }
+    for (int i = 0; i < writer_count; i++) {
+        pthread_create(&writers[i], NULL, writer_task, (void *)(intptr_t)i);
+    }
+
+    for (int i = 0; i < writer_count; i++) {
+        pthread_join(writers[i], NULL);
+    }
+    pthread_join(consumer, NULL);
+    for (int i = 0; i < SNAPSHOT_READERS; i++) {
+        pthread_join(snapshots[i], NULL);
+    }
+    for (int i = 0; i < CURSOR_READERS; i++) {
+        pthread_join(cursors[i], NULL);
+    }
+
+    long total = (long)writer_count * per_writer;
+    printf("concurrent: %ld pushed, %ld popped (%ld overwritten before the consumer got there)\n",
+           total, popped, total - popped);
+    printf("            %ld snapshots, %ld + %ld entries via cursors\n",
+           snapshot_reads[0] + snapshot_reads[1], cursor_reads[0], cursor_reads[1]);
+}
+
+typedef struct {
+    int id;
+    int quota;
+    int rounds;
+    pthread_barrier_t *barrier;
+} round_writer_t;
+
+static void *round_writer_task(void *arg)
+{
+    round_writer_t *w = arg;
+
+    for (int r = 0; r < w->rounds; r++) {
+        pthread_barrier_wait(w->barrier);
+        for (int i = 0; i < w->quota; i++) {
+            buffer_entry_t e = make_entry(w->id, (long)r * w->quota + i);
+            log_ring_push(&ring, &e);
+        }
+        pthread_barrier_wait(w->barrier);
+    }
+    return NULL;
+}
+
+/*!< All writers race for the same BUFFER_SIZE slots, then everything must be there */
+static void run_rounds(int rounds)
+{
+    int writers = writer_count < BUFFER_SIZE ? writer_count : BUFFER_SIZE;
+    pthread_t threads[WRITERS_MAX];
+    round_writer_t args[WRITERS_MAX];
+    pthread_barrier_t barrier;
+    long last[WRITERS_MAX];
+
+    log_ring_reset(&ring);
+    memset(last, 0xff, sizeof(last));
+    pthread_barrier_init(&barrier, NULL, writers + 1);
+    for (int i = 0; i < writers; i++) {
+        args[i] = (round_writer_t) {
+            .id = i,
+            .quota = BUFFER_SIZE / writers + (i < BUFFER_SIZE % writers),
+            .rounds = rounds,
+            .barrier = &barrier,
+        };
+        pthread_create(&threads[i], NULL, round_writer_task, &args[i]);
+    }
+
+    for (int r = 0; r < rounds; r++) {
+        buffer_entry_t e;
+        int popped = 0;
+
+        pthread_barrier_wait(&barrier);
+        pthread_barrier_wait(&barrier);
+        while (log_ring_pop(&ring, &e)) {
+            check_order("rounds", last, &e);
+            popped++;
+        }
+        if (popped != BUFFER_SIZE) {
+            atomic_fetch_add(&failures, 1);
+            fprintf(stderr, "rounds: round %d lost %d of %d entries\n", r, BUFFER_SIZE - popped, BUFFER_SIZE);
+        }
+    }
+
+    for (int i = 0; i < writers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_barrier_destroy(&barrier);
+    printf("rounds:     %d x %d entries from %d writers, all accounted for unless reported\n",
+           rounds, BUFFER_SIZE, writers);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:n:")) != -1) {
+        switch (opt) {
+        case 'w':
+            writer_count = atoi(optarg);
+            break;
+        case 'n':
+            per_writer = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-w writers] [-n entries per writer]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (writer_count < 1 || writer_count > WRITERS_MAX || per_writer < 1) {
+        fprintf(stderr, "writers must be 1..%d and entries at least 1\n", WRITERS_MAX);
+        return 2;
+    }
+
+    run_concurrent();
+    run_rounds(20000);
+
+    long failed = atomic_load(&failures);
+    printf("%s (%ld failures)\n", failed ? "FAIL" : "PASS", failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * Host-side replay of recorded touch traces through the touch processing
+ * code (components/touch/touch_proc.c), no board needed.
+ *
+ *   gcc -O2 -Icomponents/touch/include -o touch_replay tools/touch_replay.c \
+ *       components/touch/touch_proc.c components/touch/touch_gesture.c
+ *   ./touch_replay trace.csv            # print recognised gestures
+ *   ./touch_replay -t 0.08 trace.csv    # try another threshold on every pad
+ *   ./touch_replay -q -r 50 trace.csv   # benchmark: replay 50 times, quiet
+ *
+ * A trace is one raw reading per line, "timestamp_us,pad,raw", with pad the
+ * index in the board's button table (0 PHOTO, 1 PLAY, 2 NETWORK, 3 RECORD,
+ * 4 VOL_UP, 5 VOL_DOWN, 6 guard ring). Lines starting with '#' are skipped.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "touch_proc.h"
+
+#define PAD_COUNT 7
+
+typedef struct {
+    int64_t ts;
+    int pad;
+    uint32_t raw;
+} sample_t;
+
+static const char *pad_names[PAD_COUNT] = {"PHOTO", "PLAY", "NETWORK", "RECORD", "VOL_UP", "VOL_DOWN", "GUARD"};
+static const char *gesture_names[] = {"TAP", "DOUBLE_TAP", "LONG_PRESS", "REPEAT"};
+
+static touch_proc_t proc;
+static int64_t now_us;
+static bool quiet;
+static unsigned gesture_count;
+
+static uint32_t replay_read_baseline(void *ctx, int pad)
+{
+    (void)ctx;
+    /*!< software detection keeps its own baseline, report it as the hardware one */
+    return proc.baseline[pad];
+}
+
+static void replay_set_threshold(void *ctx, int pad, uint32_t threshold)
+{
+    /*!< software detection compares against the threshold itself */
+    (void)ctx;
+    (void)pad;
+    (void)threshold;
+}
+
+static void replay_gesture(void *ctx, int pad, touch_gesture_t gesture)
+{
+    (void)ctx;
+    gesture_count++;
+    if (!quiet) {
+        printf("%10.3f s  %-8s %s\n", now_us / 1e6, pad_names[pad], gesture_names[gesture]);
+    }
+}
+
+static sample_t *load_trace(const char *path, size_t *count)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+
+    size_t cap = 1024, n = 0;
+    sample_t *samples = malloc(cap * sizeof(sample_t));
+    char line[128];
+
+    while (samples != NULL && fgets(line, sizeof(line), f) != NULL) {
+        long long ts;
+        int pad;
+        unsigned raw;
+
+        if (line[0] == '#' || sscanf(line, "%lld,%d,%u", &ts, &pad, &raw) != 3) {
+            continue;
+        }
+        if (pad < 0 || pad >= PAD_COUNT) {
+            continue;
+        }
+        if (n == cap) {
+            cap *= 2;
+            samples = realloc(samples, cap * sizeof(sample_t));
+            if (samples == NULL) {
+                break;
+            }
+        }
+        samples[n].ts = ts;
+        samples[n].pad = pad;
+        samples[n].raw = raw;
+        n++;
+    }
+
+    fclose(f);
+    *count = n;
+    return samples;
+}
+
+static void replay(const sample_t *samples, size_t count, float threshold)
+{
+    const touch_hal_t hal = {
+        .read_baseline = replay_read_baseline,
+        .set_threshold = replay_set_threshold,
+        .gesture = replay_gesture,
+    };
+    /*!< same roles as the button table in touch.c */
+    touch_proc_pad_t pads[PAD_COUNT] = {
+        {.double_tap = false},
+        {.double_tap = true},
+        {.double_tap = false},
+        {.double_tap = false},
+        {.repeat = true},
+        {.repeat = true},
+        {.guard = true},
+    };
+    touch_gesture_config_t config = TOUCH_GESTURE_DEFAULT_CONFIG();
+
+    for (int i = 0; i < PAD_COUNT; i++) {
+        pads[i].threshold = threshold;
+    }
+    touch_proc_init(&proc, &hal, &config, pads, PAD_COUNT);
+
+    int64_t deadline = 0;
+    for (size_t i = 0; i < count; i++) {
+        /*!< timed gestures fire at their deadline, not at the next sample */
+        while (deadline != 0 && deadline <= samples[i].ts) {
+            now_us = deadline;
+            deadline = touch_proc_tick(&proc, now_us);
+        }
+        now_us = samples[i].ts;
+        touch_proc_sample(&proc, samples[i].pad, samples[i].raw, now_us);
+        deadline = touch_proc_tick(&proc, now_us);
+    }
+    while (deadline != 0) {
+        now_us = deadline;
+        deadline = touch_proc_tick(&proc, now_us);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    float threshold = 0.1f;
+    int rounds = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "qr:t:")) != -1) {
+        switch (opt) {
+        case 'q':
+            quiet = true;
+            break;
+        case 'r':
+            rounds = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        case 't':
+            threshold = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-q] [-r rounds] [-t threshold] trace.csv\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-q] [-r rounds] [-t threshold] trace.csv\n", argv[0]);
+        return 2;
+    }
+
+    size_t count = 0;
+    sample_t *samples = load_trace(argv[optind], &count);
+    if (samples == NULL) {
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; r++) {
+        replay(samples, count, threshold);
+        quiet = true;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    fprintf(stderr, "%zu samples x %d rounds, %u gestures, %.1f ns per sample\n",
+            count, rounds, gesture_count / rounds, count ? ns / ((double)count * rounds) : 0.0);
+
+    free(samples);
+    return 0;
+}
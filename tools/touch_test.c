@@ -0,0 +1,261 @@
+/*
+ * Host-side checks of gesture recognition and guard ring handling in
+ * components/touch (touch_proc.c, touch_gesture.c), no board needed.
+ *
+ *   gcc -O2 -Wall -Wextra -Icomponents/touch/include -o touch_test tools/touch_test.c \
+ *       components/touch/touch_proc.c components/touch/touch_gesture.c
+ *   ./touch_test
+ *
+ * Each case feeds scripted edges through touch_proc_edge(), runs the timed
+ * gestures at their deadlines like the touch task does, and compares what
+ * came out with the expected gestures and times. Uses the default gesture
+ * timings and the board's pad roles.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "touch_proc.h"
+
+#define MS 1000LL
+
+enum {
+    PAD_PHOTO,      /*!< plain: tap, long press */
+    PAD_PLAY,       /*!< double tap */
+    PAD_VOL_UP,     /*!< repeat */
+    PAD_GUARD,
+    PAD_COUNT
+};
+
+#define EXPECT_MAX 8
+
+typedef struct {
+    int64_t at_us;
+    int pad;
+    bool active;
+} step_t;
+
+typedef struct {
+    int64_t at_us;
+    int pad;
+    touch_gesture_t gesture;
+} seen_t;
+
+static const char *gesture_names[] = {"TAP", "DOUBLE_TAP", "LONG_PRESS", "REPEAT"};
+
+static touch_proc_t proc;
+static int64_t now_us;
+static seen_t seen[EXPECT_MAX];
+static int seen_count;
+static int failures;
+
+static uint32_t test_read_baseline(void *ctx, int pad)
+{
+    (void)ctx;
+    (void)pad;
+    return 1000;
+}
+
+static void test_set_threshold(void *ctx, int pad, uint32_t threshold)
+{
+    (void)ctx;
+    (void)pad;
+    (void)threshold;
+}
+
+static void test_gesture(void *ctx, int pad, touch_gesture_t gesture)
+{
+    (void)ctx;
+    if (seen_count < EXPECT_MAX) {
+        seen[seen_count].at_us = now_us;
+        seen[seen_count].pad = pad;
+        seen[seen_count].gesture = gesture;
+    }
+    seen_count++;
+}
+
+static void setup(void)
+{
+    const touch_hal_t hal = {
+        .read_baseline = test_read_baseline,
+        .set_threshold = test_set_threshold,
+        .gesture = test_gesture,
+    };
+    const touch_proc_pad_t pads[PAD_COUNT] = {
+        [PAD_PHOTO] = {.threshold = 0.1f},
+        [PAD_PLAY] = {.threshold = 0.1f, .double_tap = true},
+        [PAD_VOL_UP] = {.threshold = 0.1f, .repeat = true},
+        [PAD_GUARD] = {.threshold = 0.1f, .guard = true},
+    };
+    touch_gesture_config_t config = TOUCH_GESTURE_DEFAULT_CONFIG();
+
+    touch_proc_init(&proc, &hal, &config, pads, PAD_COUNT);
+    touch_proc_calibrate(&proc);
+    now_us = 0;
+    seen_count = 0;
+}
+
+/*!< Play the steps, firing every deadline on time, then run on until end_us */
+static void run(const step_t *steps, int count, int64_t end_us)
+{
+    int64_t deadline = 0;
+
+    for (int i = 0; i <= count; i++) {
+        int64_t until = i < count ? steps[i].at_us : end_us;
+
+        while (deadline != 0 && deadline <= until) {
+            now_us = deadline;
+            deadline = touch_proc_tick(&proc, now_us);
+        }
+        if (i == count) {
+            break;
+        }
+        now_us = steps[i].at_us;
+        touch_proc_edge(&proc, steps[i].pad, steps[i].active, now_us);
+        deadline = touch_proc_tick(&proc, now_us);
+    }
+}
+
+static void check(const char *name, const seen_t *expect, int count)
+{
+    bool ok = seen_count == count;
+
+    for (int i = 0; ok && i < count; i++) {
+        ok = seen[i].pad == expect[i].pad && seen[i].gesture == expect[i].gesture &&
+             seen[i].at_us == expect[i].at_us;
+    }
+
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", name);
+    if (!ok) {
+        failures++;
+        for (int i = 0; i < count; i++) {
+            printf("       want %6lld ms pad %d %s\n", (long long)(expect[i].at_us / MS), expect[i].pad,
+                   gesture_names[expect[i].gesture]);
+        }
+        for (int i = 0; i < seen_count && i < EXPECT_MAX; i++) {
+            printf("       got  %6lld ms pad %d %s\n", (long long)(seen[i].at_us / MS), seen[i].pad,
+                   gesture_names[seen[i].gesture]);
+        }
+    }
+}
+
+#define CASE(name, end_ms, steps, ...) do {                                         \
+        const seen_t expect_[] = {__VA_ARGS__};                                     \
+        setup();                                                                    \
+        run(steps, sizeof(steps) / sizeof(steps[0]), (end_ms) * MS);                \
+        check(name, expect_, sizeof(expect_) / sizeof(seen_t));                     \
+    } while (0)
+
+/*!< Cases that must not produce any gesture */
+static void check_none(const char *name, const step_t *steps, int count, int64_t end_ms)
+{
+    setup();
+    run(steps, count, end_ms * MS);
+    check(name, NULL, 0);
+}
+
+int main(void)
+{
+    const step_t tap[] = {
+        {0, PAD_PHOTO, true},
+        {100 * MS, PAD_PHOTO, false},
+    };
+    CASE("tap", 2000, tap, {100 * MS, PAD_PHOTO, TOUCH_GESTURE_TAP});
+
+    const step_t single_on_double[] = {
+        {0, PAD_PLAY, true},
+        {100 * MS, PAD_PLAY, false},
+    };
+    CASE("tap on a double tap pad waits out the window", 2000, single_on_double,
+         {350 * MS, PAD_PLAY, TOUCH_GESTURE_TAP});
+
+    const step_t double_tap[] = {
+        {0, PAD_PLAY, true},
+        {100 * MS, PAD_PLAY, false},
+        {200 * MS, PAD_PLAY, true},
+        {300 * MS, PAD_PLAY, false},
+    };
+    CASE("double tap", 2000, double_tap, {300 * MS, PAD_PLAY, TOUCH_GESTURE_DOUBLE_TAP});
+
+    const step_t long_press[] = {
+        {0, PAD_PHOTO, true},
+        {1000 * MS, PAD_PHOTO, false},
+    };
+    CASE("long press, no tap on release", 2000, long_press, {800 * MS, PAD_PHOTO, TOUCH_GESTURE_LONG_PRESS});
+
+    const step_t repeat[] = {
+        {0, PAD_VOL_UP, true},
+        {800 * MS, PAD_VOL_UP, false},
+    };
+    CASE("repeat while held", 2000, repeat,
+         {0, PAD_VOL_UP, TOUCH_GESTURE_TAP},
+         {400 * MS, PAD_VOL_UP, TOUCH_GESTURE_REPEAT},
+         {550 * MS, PAD_VOL_UP, TOUCH_GESTURE_REPEAT},
+         {700 * MS, PAD_VOL_UP, TOUCH_GESTURE_REPEAT});
+
+    const step_t bounce[] = {
+        {0, PAD_PHOTO, true},
+        {100 * MS, PAD_PHOTO, false},
+        {110 * MS, PAD_PHOTO, true},
+        {150 * MS, PAD_PHOTO, false},
+    };
+    CASE("press inside the debounce time is a bounce", 2000, bounce, {100 * MS, PAD_PHOTO, TOUCH_GESTURE_TAP});
+
+    const step_t glitch[] = {
+        {0, PAD_PHOTO, true},
+        {10 * MS, PAD_PHOTO, false},
+    };
+    check_none("contact shorter than min_press is ignored", glitch, 2, 2000);
+
+    const step_t glitch_between_taps[] = {
+        {0, PAD_PLAY, true},
+        {100 * MS, PAD_PLAY, false},
+        {150 * MS, PAD_PLAY, true},
+        {160 * MS, PAD_PLAY, false},
+    };
+    CASE("glitch keeps the pending tap and its deadline", 2000, glitch_between_taps,
+         {350 * MS, PAD_PLAY, TOUCH_GESTURE_TAP});
+
+    const step_t guard_cancel[] = {
+        {0, PAD_PHOTO, true},
+        {50 * MS, PAD_GUARD, true},
+        {100 * MS, PAD_PHOTO, false},
+        {200 * MS, PAD_GUARD, false},
+    };
+    check_none("guard ring cancels a press and its release", guard_cancel, 4, 2000);
+
+    const step_t guard_long[] = {
+        {0, PAD_PHOTO, true},
+        {100 * MS, PAD_GUARD, true},
+        {200 * MS, PAD_GUARD, false},
+        {1000 * MS, PAD_PHOTO, false},
+    };
+    check_none("cancelled press never turns into a long press", guard_long, 4, 2000);
+
+    const step_t guard_first[] = {
+        {0, PAD_GUARD, true},
+        {50 * MS, PAD_PHOTO, true},
+        {150 * MS, PAD_PHOTO, false},
+        {300 * MS, PAD_GUARD, false},
+    };
+    check_none("pads are ignored while the guard ring is touched", guard_first, 4, 2000);
+
+    const step_t guard_pending_tap[] = {
+        {0, PAD_PLAY, true},
+        {100 * MS, PAD_PLAY, false},
+        {150 * MS, PAD_GUARD, true},
+        {200 * MS, PAD_GUARD, false},
+    };
+    check_none("guard ring drops a tap waiting for its pair", guard_pending_tap, 4, 2000);
+
+    const step_t after_guard[] = {
+        {0, PAD_GUARD, true},
+        {100 * MS, PAD_GUARD, false},
+        {200 * MS, PAD_PHOTO, true},
+        {300 * MS, PAD_PHOTO, false},
+    };
+    CASE("pads work again once the guard ring is released", 2000, after_guard,
+         {300 * MS, PAD_PHOTO, TOUCH_GESTURE_TAP});
+
+    printf("%s (%d failures)\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
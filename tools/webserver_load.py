@@ -0,0 +1,187 @@
+#!/usr/bin/env python
+#
+# Concurrent-client load generator for the player web server.
+#
+# Simulates N dashboard clients hammering /logs, /event-type and /config and
+# reports per-endpoint p50/p99 latency, plus the number of audio underruns the
+# device counted during the run (read from the "underruns" field of /state).
+#
+#   python tools/webserver_load.py --host 192.168.4.1 --clients 8 --duration 30
+#   python tools/webserver_load.py --stub --clients 8     # self-test, no device
+#
+# POST /event-type uses an unknown event number by default so the run does not
+# change what is playing; pass --event to send a real command instead.
+#
+import argparse
+import http.client
+import json
+import random
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+ENDPOINTS = {
+    'logs': ('GET', '/logs'),
+    'event-type': ('POST', '/event-type?event={event}'),
+    'config': ('GET', '/config'),
+}
+
+
+class StubHandler(BaseHTTPRequestHandler):
+    """Host-side stand-in for the device handlers, with similar payloads."""
+
+    underruns = 0
+
+    def _reply(self, body, content_type='application/json'):
+        data = body.encode()
+        self.send_response(200)
+        self.send_header('Content-Type', content_type)
+        self.send_header('Content-Length', str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def do_GET(self):
+        if self.path.startswith('/logs'):
+            entries = [{'event': 'NEXT', 'song_id': i % 3, 'timestamp': None} for i in range(20)]
+            self._reply(json.dumps({'buffer': entries}, indent=1))
+        elif self.path.startswith('/config'):
+            self._reply(json.dumps({'broker': 'mqtt://broker', 'topic': 'player'}, indent=1))
+        elif self.path.startswith('/state'):
+            self._reply(json.dumps({'version': 1, 'song_id': 0, 'play_state': 'PLAYING',
+                                    'volume': 50, 'position_ms': 0, 'underruns': StubHandler.underruns}))
+        else:
+            self.send_error(404)
+
+    def do_POST(self):
+        length = int(self.headers.get('Content-Length') or 0)
+        self.rfile.read(length)
+        if self.path.startswith('/event-type'):
+            self._reply('Event received and processed', 'text/plain')
+        else:
+            self.send_error(404)
+
+    def log_message(self, *args):
+        pass
+
+
+def percentile(samples, pct):
+    if not samples:
+        return float('nan')
+    ordered = sorted(samples)
+    index = min(len(ordered) - 1, int(round(pct / 100.0 * (len(ordered) - 1))))
+    return ordered[index]
+
+
+def read_underruns(host, port, timeout):
+    try:
+        conn = http.client.HTTPConnection(host, port, timeout=timeout)
+        conn.request('GET', '/state')
+        resp = conn.getresponse()
+        body = resp.read()
+        conn.close()
+        if resp.status != 200:
+            return None
+        return json.loads(body).get('underruns')
+    except (OSError, ValueError, http.client.HTTPException):
+        return None
+
+
+def client_loop(args, deadline, results, lock):
+    conn = None
+    rng = random.Random()
+    local = {name: [] for name in ENDPOINTS}
+    errors = {name: 0 for name in ENDPOINTS}
+
+    while time.time() < deadline:
+        name = rng.choice(args.endpoints)
+        method, path = ENDPOINTS[name]
+        path = path.format(event=args.event)
+        start = time.time()
+        try:
+            if conn is None:
+                conn = http.client.HTTPConnection(args.host, args.port, timeout=args.timeout)
+            conn.request(method, path, body=b'' if method == 'POST' else None)
+            resp = conn.getresponse()
+            resp.read()
+            if resp.status >= 400:
+                errors[name] += 1
+            else:
+                local[name].append((time.time() - start) * 1000.0)
+        except (OSError, http.client.HTTPException):
+            errors[name] += 1
+            if conn is not None:
+                conn.close()
+            conn = None
+        if args.think_ms:
+            time.sleep(args.think_ms / 1000.0)
+
+    if conn is not None:
+        conn.close()
+
+    with lock:
+        for name in ENDPOINTS:
+            results[name]['latency'].extend(local[name])
+            results[name]['errors'] += errors[name]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Concurrent HTTP load generator for the player web server')
+    parser.add_argument('--host', default='192.168.4.1', help='device address (softAP default)')
+    parser.add_argument('--port', type=int, default=80)
+    parser.add_argument('--clients', type=int, default=4, help='concurrent simulated dashboards')
+    parser.add_argument('--duration', type=float, default=20.0, help='seconds to run')
+    parser.add_argument('--think-ms', type=float, default=0.0, help='pause between requests per client')
+    parser.add_argument('--timeout', type=float, default=10.0, help='per-request timeout in seconds')
+    parser.add_argument('--event', type=int, default=99, help='event number sent to /event-type')
+    parser.add_argument('--endpoints', default=','.join(ENDPOINTS), help='comma separated subset to drive')
+    parser.add_argument('--stub', action='store_true', help='run against a local stub instead of a device')
+    args = parser.parse_args()
+
+    args.endpoints = [name for name in args.endpoints.split(',') if name]
+    unknown = [name for name in args.endpoints if name not in ENDPOINTS]
+    if unknown:
+        parser.error('unknown endpoints: %s' % ', '.join(unknown))
+
+    stub = None
+    if args.stub:
+        stub = ThreadingHTTPServer(('127.0.0.1', 0), StubHandler)
+        args.host, args.port = stub.server_address
+        threading.Thread(target=stub.serve_forever, daemon=True).start()
+
+    underruns_before = read_underruns(args.host, args.port, args.timeout)
+
+    results = {name: {'latency': [], 'errors': 0} for name in ENDPOINTS}
+    lock = threading.Lock()
+    deadline = time.time() + args.duration
+    threads = [threading.Thread(target=client_loop, args=(args, deadline, results, lock))
+               for _ in range(args.clients)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    underruns_after = read_underruns(args.host, args.port, args.timeout)
+
+    print('%d clients, %.0f s against %s:%d' % (args.clients, args.duration, args.host, args.port))
+    print('%-12s %8s %8s %10s %10s %10s' % ('endpoint', 'ok', 'errors', 'req/s', 'p50 ms', 'p99 ms'))
+    for name in args.endpoints:
+        latency = results[name]['latency']
+        print('%-12s %8d %8d %10.1f %10.1f %10.1f' % (name, len(latency), results[name]['errors'],
+                                                      len(latency) / args.duration,
+                                                      percentile(latency, 50), percentile(latency, 99)))
+
+    if underruns_before is None or underruns_after is None:
+        print('audio underruns: unknown (/state not reachable)')
+    else:
+        print('audio underruns during run: %d' % (underruns_after - underruns_before))
+
+    if stub is not None:
+        stub.shutdown()
+
+    failed = sum(results[name]['errors'] for name in args.endpoints)
+    return 1 if failed and not any(results[name]['latency'] for name in args.endpoints) else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())